@@ -0,0 +1,200 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+
+// Loopback benchmark of UDP receive engines. A child process sends Afedri-like packets to 127.0.0.1, this process
+// receives them with every engine in turn and reads the channel ring like a stream does. Prints packets received,
+// losses and CPU time of the receiving process per packet (the sender is not counted).
+//
+// Usage: afedri_rx_bench [packets] [engine ...]    engines: select recvmmsg reactor io_uring (default - all)
+
+#include "inet_common.h"
+#include "udp_rx.hpp"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+constexpr int bench_port = 50150;
+constexpr size_t packet_len = 1028; // 4 bytes of header and 1024 bytes of payload
+constexpr int burst = 64;           // packets sent back to back, then the sender sleeps
+constexpr int burst_pause_us = 50;
+
+static void log_print(std::string const &s)
+{
+    if (s.find("granted") == std::string::npos)
+    {
+        std::printf("  %s\n", s.c_str());
+    }
+}
+
+static double cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void send_packets(int num_packets)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(bench_port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    unsigned char packet[packet_len] = {0};
+    for (int idx = 0; idx < num_packets; idx++)
+    {
+        packet[2] = idx & 0xff; // packet counter
+        packet[3] = (idx >> 8) & 0xff;
+        sendto(sock, reinterpret_cast<const char *>(packet), packet_len, 0, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        if (idx % burst == burst - 1)
+        {
+            usleep(burst_pause_us);
+        }
+    }
+    closesocket(sock);
+}
+
+static const char *engine_name(UdpRxEngine engine)
+{
+    switch (engine)
+    {
+    case UdpRxEngine::Select:
+        return "select";
+    case UdpRxEngine::RecvMmsg:
+        return "recvmmsg";
+    case UdpRxEngine::Reactor:
+        return "reactor";
+    case UdpRxEngine::IoUring:
+        return "io_uring";
+    }
+    return "?";
+}
+
+static bool run(UdpRxEngine engine, int num_packets)
+{
+    UdpRxOptions options;
+    options.engine = engine;
+    options.rcvbuf = 8 << 20;
+
+    std::printf("%s:\n", engine_name(engine));
+    auto ctx = UdpRxControl::start_thread(1, "127.0.0.1", bench_port, options, log_print);
+    const size_t slot_len = ctx->elements_per_packet();
+    const size_t ring_len = slot_len * 4096;
+    ctx->rings[0].ring.allocate(ring_len);
+    ctx->rings[0].time_tags.allocate(ring_len, slot_len);
+    ctx->channels[0].emplace_back(1, ctx->rings[0]);
+    StreamItem &item = ctx->channels[0][0];
+    item.reset();
+    item.set_active(true);
+    ctx->rx_active = true;
+
+    const pid_t sender = fork();
+    if (sender == 0)
+    {
+        send_packets(num_packets);
+        _exit(0);
+    }
+    if (sender < 0)
+    {
+        std::printf("  fork failed\n");
+        UdpRxControl::stop_thread(ctx);
+        return false;
+    }
+
+    const double cpu_start = cpu_seconds();
+    const auto start = std::chrono::steady_clock::now();
+    auto last_data = start;
+    std::vector<short> buf(ring_len);
+    size_t total = 0;
+    bool sent = false;
+    for (;;)
+    {
+        if (item.wait_for_data(std::chrono::milliseconds(300)))
+        {
+            total += item.buffer.read(buf.data(), buf.size());
+            last_data = std::chrono::steady_clock::now();
+        }
+        else if (sent)
+        {
+            break; // nothing more comes
+        }
+        int status = 0;
+        if (!sent && waitpid(sender, &status, WNOHANG) == sender)
+        {
+            sent = true;
+        }
+    }
+    const double cpu = cpu_seconds() - cpu_start;
+    const double seconds = std::chrono::duration<double>(last_data - start).count();
+
+    const size_t received = total / slot_len;
+    std::printf("  engine=%s packets=%zu/%d lost=%llu kernel_drops=%u rate=%.0f packets/s cpu=%.3f s (%.2f us/packet)\n",
+                engine_name(ctx->options.engine), received, num_packets, (unsigned long long)ctx->packets_lost.load(),
+                (unsigned)ctx->kernel_drops.load(), (seconds > 0) ? received / seconds : 0.0, cpu, received ? cpu * 1e6 / received : 0.0);
+    UdpRxControl::stop_thread(ctx);
+    return received != 0;
+}
+
+int main(int argc, char **argv)
+{
+    int num_packets = 400000;
+    std::vector<UdpRxEngine> engines;
+    for (int idx = 1; idx < argc; idx++)
+    {
+        const std::string arg = argv[idx];
+        if (arg == "select")
+        {
+            engines.push_back(UdpRxEngine::Select);
+        }
+        else if (arg == "recvmmsg")
+        {
+            engines.push_back(UdpRxEngine::RecvMmsg);
+        }
+        else if (arg == "reactor")
+        {
+            engines.push_back(UdpRxEngine::Reactor);
+        }
+        else if (arg == "io_uring")
+        {
+            engines.push_back(UdpRxEngine::IoUring);
+        }
+        else if (std::atoi(arg.c_str()) > 0)
+        {
+            num_packets = std::atoi(arg.c_str());
+        }
+        else
+        {
+            std::printf("Usage: %s [packets] [select|recvmmsg|reactor|io_uring ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (engines.empty())
+    {
+        engines = {UdpRxEngine::Select, UdpRxEngine::RecvMmsg, UdpRxEngine::Reactor, UdpRxEngine::IoUring};
+    }
+
+    bool ok = true;
+    for (UdpRxEngine engine : engines)
+    {
+        try
+        {
+            ok = run(engine, num_packets) && ok;
+        }
+        catch (UdpRxError const &ex)
+        {
+            std::printf("  %s\n", ex.what());
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "soapy_afedri.hpp"
+
+#include <SoapySDR/Logger.hpp>
+
+// DC offset and IQ imbalance are corrected by RX thread once per hardware channel, before data is put to the channel ring,
+// so corrected data is shared by all streams of the channel. Values are relative to full scale 1.0.
+
+IqCorrector &AfedriDevice::channel_correction(size_t channel) const
+{
+    const size_t hw_channel = remap_channel(channel);
+    auto const &udp_rx_ctx = _udp_rx_thread_defer->get_ctx();
+    if (hw_channel >= udp_rx_ctx->rings.size())
+    {
+        throw std::runtime_error("Afedri: invalid channel " + std::to_string(channel));
+    }
+    return udp_rx_ctx->rings[hw_channel].correction;
+}
+
+bool AfedriDevice::hasDCOffsetMode(const int /* direction */, const size_t /* channel */) const
+{
+    return true;
+}
+
+void AfedriDevice::setDCOffsetMode(const int /* direction */, const size_t channel, const bool automatic)
+{
+    SoapySDR::logf(SOAPY_SDR_INFO, "Afedri: automatic DC offset removal channel=%d: %s", (int)channel, automatic ? "on" : "off");
+    channel_correction(channel).set_dc_auto(automatic);
+}
+
+bool AfedriDevice::getDCOffsetMode(const int /* direction */, const size_t channel) const
+{
+    return channel_correction(channel).dc_auto();
+}
+
+bool AfedriDevice::hasDCOffset(const int /* direction */, const size_t /* channel */) const
+{
+    return true;
+}
+
+void AfedriDevice::setDCOffset(const int /* direction */, const size_t channel, const std::complex<double> &offset)
+{
+    // subtracted from samples when automatic mode is off
+    channel_correction(channel).set_dc_offset(static_cast<float>(offset.real()), static_cast<float>(offset.imag()));
+}
+
+std::complex<double> AfedriDevice::getDCOffset(const int /* direction */, const size_t channel) const
+{
+    float i;
+    float q;
+    channel_correction(channel).get_dc_offset(i, q); // in automatic mode the current estimate
+    return std::complex<double>(i, q);
+}
+
+bool AfedriDevice::hasIQBalance(const int /* direction */, const size_t /* channel */) const
+{
+    return true;
+}
+
+void AfedriDevice::setIQBalance(const int /* direction */, const size_t channel, const std::complex<double> &balance)
+{
+    // samples are corrected as x + balance * conj(x) when automatic mode is off
+    channel_correction(channel).set_iq_balance(static_cast<float>(balance.real()), static_cast<float>(balance.imag()));
+    _saved_iq_balance[channel] = balance;
+}
+
+std::complex<double> AfedriDevice::getIQBalance(const int /* direction */, const size_t channel) const
+{
+    auto it = _saved_iq_balance.find(channel);
+    return (it != _saved_iq_balance.end()) ? it->second : std::complex<double>(0.0, 0.0);
+}
+
+#ifdef SOAPY_SDR_API_HAS_IQ_BALANCE_MODE
+
+bool AfedriDevice::hasIQBalanceMode(const int /* direction */, const size_t /* channel */) const
+{
+    return true;
+}
+
+void AfedriDevice::setIQBalanceMode(const int /* direction */, const size_t channel, const bool automatic)
+{
+    SoapySDR::logf(SOAPY_SDR_INFO, "Afedri: automatic IQ balance channel=%d: %s", (int)channel, automatic ? "on" : "off");
+    channel_correction(channel).set_iq_auto(automatic);
+}
+
+bool AfedriDevice::getIQBalanceMode(const int /* direction */, const size_t channel) const
+{
+    return channel_correction(channel).iq_auto();
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include <SoapySDR/Logger.hpp>
 // #include <SoapySDR/Types.h>
 
+#include "sample_convert.hpp"
+
 #include <algorithm>
 #include <iostream>
 
@@ -17,20 +19,22 @@ static void debug_print_for_thread(std::string const &str)
 }
 
 AfedriDevice::AfedriDevice(std::string const &address, int port, std::string const &bind_address, int bind_port, int afedri_mode,
-                           int num_channels, int map_ch0)
-    : _afedri_control(address, port),
+                           int num_channels, int map_ch0, UdpRxOptions const &rx_options, bool resample)
+    : _afedri_control(new AfedriControl(address, port)),
       _bind_address(bind_address),
       _bind_port(bind_port),
       _afedri_rx_mode(afedri_mode),
       _num_channels(num_channels),
       _map_ch0(map_ch0),
+      _rx_options(rx_options),
+      _resample(resample),
       _stream_sequence_provider(1),
       _saved_frequency(0.0),
       _saved_sample_rate(0.0),
       _saved_bandwidth(0.0)
 {
 
-    _version_info = _afedri_control.get_version_info();
+    _version_info = _afedri_control->get_version_info();
 
     // Validate provided  rx_mode
     if (_afedri_rx_mode < 0 || _afedri_rx_mode > 5)
@@ -42,7 +46,7 @@ AfedriDevice::AfedriDevice(std::string const &address, int port, std::string con
     {
         // set rx mode only if provided
         auto ch = AfedriControl::make_afedri_channel_from_0based_index(0); // TODO: Check what channel to use here?
-        _afedri_control.set_rx_mode(ch, static_cast<AfedriControl::RxMode>(_afedri_rx_mode));
+        _afedri_control->set_rx_mode(ch, static_cast<AfedriControl::RxMode>(_afedri_rx_mode));
         SoapySDR::logf(SOAPY_SDR_WARNING, "Afedri set_rx_mode to %d", _afedri_rx_mode);
     }
 
@@ -50,8 +54,8 @@ AfedriDevice::AfedriDevice(std::string const &address, int port, std::string con
     if (_version_info.is_r820t_present)
     {
         auto ch = AfedriControl::make_afedri_channel_from_0based_index(remap_channel(0));
-        _afedri_control.set_r820t_lna_agc(ch, 0);
-        _afedri_control.set_r820t_mixer_agc(ch, 0);
+        _afedri_control->set_r820t_lna_agc(ch, 0);
+        _afedri_control->set_r820t_mixer_agc(ch, 0);
     }
 
     if (_num_channels > 0 && _num_channels <= 4)
@@ -62,7 +66,7 @@ AfedriDevice::AfedriDevice(std::string const &address, int port, std::string con
     else
     {
         // get number of channels from readed rx mode
-        auto readed_rx_mode = _afedri_control.get_rx_mode();
+        auto readed_rx_mode = _afedri_control->get_rx_mode();
         _num_channels = AfedriControl::rx_mode_to_number_of_channels(readed_rx_mode);
         SoapySDR::logf(SOAPY_SDR_INFO, "Afedri readed_rx_mode=%d, _num_channels=%d", readed_rx_mode, _num_channels);
     }
@@ -77,7 +81,7 @@ AfedriDevice::AfedriDevice(std::string const &address, int port, std::string con
     // Create UDP Rx process
     try
     {
-        auto thrctx = UdpRxControl::start_thread(_num_channels, _bind_address, _bind_port, debug_print_for_thread);
+        auto thrctx = UdpRxControl::start_thread(_num_channels, _bind_address, _bind_port, _rx_options, debug_print_for_thread);
         _udp_rx_thread_defer.reset(new UdpRxContextDefer(thrctx)); // this is for automatically stop thread on destroy driver
     }
     catch (UdpRxError &ex)
@@ -86,9 +90,53 @@ AfedriDevice::AfedriDevice(std::string const &address, int port, std::string con
         throw;
     }
 
+    SoapySDR::logf(SOAPY_SDR_INFO, "Afedri CS16->CF32 conversion: %s", convert_s16_to_f32_impl_name());
     SoapySDR::logf(SOAPY_SDR_INFO, "Afedri device created.");
 }
 
+AfedriDevice::AfedriDevice(ReplayOptions const &replay, RecordMeta const &meta, int num_channels, UdpRxOptions const &rx_options)
+    : _bind_port(0),
+      _afedri_rx_mode(-1),
+      _num_channels(num_channels),
+      _map_ch0(-1),
+      _rx_options(rx_options),
+      _resample(false),
+      _stream_sequence_provider(1),
+      _saved_gains(meta.gains),
+      _saved_frequency(meta.frequency),
+      _saved_sample_rate(replay.sample_rate),
+      _saved_bandwidth(0.0)
+{
+    _version_info.version_string = meta.hw.empty() ? "Afedri replay" : meta.hw + " (replay)";
+    _version_info.serial_number = replay.file;
+
+    try
+    {
+        auto thrctx = UdpRxControl::start_replay_thread(_num_channels, replay, _rx_options, debug_print_for_thread);
+        _udp_rx_thread_defer.reset(new UdpRxContextDefer(thrctx));
+    }
+    catch (UdpRxError &ex)
+    {
+        SoapySDR::logf(SOAPY_SDR_ERROR, "Afedri replay: %s", ex.what());
+        throw;
+    }
+
+    SoapySDR::logf(SOAPY_SDR_INFO, "Afedri replay device created. file=%s, channels=%d, rate=%.0f, paced=%d, loop=%d", replay.file.c_str(),
+                   (int)_num_channels, replay.sample_rate, (int)replay.paced, (int)replay.loop);
+}
+
+AfedriDevice::~AfedriDevice()
+{
+    try
+    {
+        stop_recording(); // finish files while RX context is alive
+    }
+    catch (std::exception const &ex)
+    {
+        SoapySDR::logf(SOAPY_SDR_ERROR, "Afedri stop recording: %s", ex.what());
+    }
+}
+
 std::string AfedriDevice::getDriverKey(void) const
 {
     return "Afedri";
@@ -13,8 +13,11 @@ void AfedriDevice::setFrequency(const int /*direction*/, const size_t channel, c
     if (name == "RF")
     {
         SoapySDR_logf(SOAPY_SDR_INFO, "Afedri: Setting center freq. channel=%d, freq=%d", (int)channel, (uint32_t)frequency);
-        const auto ch = AfedriControl::make_afedri_channel_from_0based_index(remap_channel(channel));
-        _afedri_control.set_frequency(ch, (uint32_t)frequency);
+        if (_afedri_control)
+        {
+            const auto ch = AfedriControl::make_afedri_channel_from_0based_index(remap_channel(channel));
+            _afedri_control->set_frequency(ch, (uint32_t)frequency);
+        }
 
         _saved_frequency = frequency;
     }
@@ -41,26 +41,30 @@ void AfedriDevice::setGain(const int /*direction*/, const size_t channel, const
     SoapySDR_logf(SOAPY_SDR_INFO, "Afedri: setGain Name=%s, Gain=%f ", name.c_str(), value);
     const auto ch = AfedriControl::make_afedri_channel_from_0based_index(remap_channel(channel));
     _saved_gains[name] = value;
+    if (!_afedri_control)
+    {
+        return; // replay device
+    }
 
     if (name == RF)
     {
-        _afedri_control.set_rf_gain(ch, value);
+        _afedri_control->set_rf_gain(ch, value);
     }
     else if (name == FE)
     {
-        _afedri_control.set_fe_gain(ch, value);
+        _afedri_control->set_fe_gain(ch, value);
     }
     else if (name == R820T_LNA_GAIN)
     {
-        _afedri_control.set_r820t_lna_gain(ch, value);
+        _afedri_control->set_r820t_lna_gain(ch, value);
     }
     else if (name == R820T_MIXER_GAIN)
     {
-        _afedri_control.set_r820t_mixer_gain(ch, value);
+        _afedri_control->set_r820t_mixer_gain(ch, value);
     }
     else if (name == R820T_VGA_GAIN)
     {
-        _afedri_control.set_r820t_vga_gain(ch, value);
+        _afedri_control->set_r820t_vga_gain(ch, value);
     }
     else
     {
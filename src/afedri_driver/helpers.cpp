@@ -5,15 +5,9 @@
 #include <SoapySDR/Formats.hpp>
 #include <SoapySDR/Logger.hpp>
 
-StreamContext &AfedriDevice::get_stream_context_by_id(int stream_id)
+StreamContext &AfedriDevice::get_stream_context(SoapySDR::Stream *stream)
 {
-    const auto it = _configured_streams.find(stream_id);
-    if (it == _configured_streams.end())
-    {
-        SoapySDR::logf(SOAPY_SDR_ERROR, "call with incorrect or closed stream. stream_id=%d", stream_id);
-        throw std::runtime_error("incorrect stream_id");
-    }
-    return it->second;
+    return *reinterpret_cast<StreamContext *>(stream);
 }
 
 AfedriControl::VersionInfo const &AfedriDevice::get_version_info() const
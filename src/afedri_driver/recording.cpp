@@ -0,0 +1,121 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "soapy_afedri.hpp"
+
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Logger.hpp>
+
+#include "recorder.hpp"
+
+// Rings of recording stream hold this much, so the writer survives disk stalls of that length without loss.
+static const char *const record_ring_ms = "2000";
+
+// "/data/cap.sigmf-data", "/data/cap.sigmf-meta" and "/data/cap" all name recording "/data/cap".
+static std::string strip_sigmf_extension(std::string const &path)
+{
+    for (std::string const ext : {".sigmf-data", ".sigmf-meta"})
+    {
+        if (path.size() > ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0)
+        {
+            return path.substr(0, path.size() - ext.size());
+        }
+    }
+    return path;
+}
+
+void AfedriDevice::start_recording()
+{
+    std::unique_lock<std::mutex> lock(_record_mtx);
+    if (_recorder)
+    {
+        SoapySDR::log(SOAPY_SDR_WARNING, "Afedri recording is already running");
+        return;
+    }
+
+    auto it = _saved_settings.find("record_path");
+    const std::string base = strip_sigmf_extension((it != _saved_settings.end()) ? it->second : std::string());
+    if (base.empty())
+    {
+        SoapySDR::log(SOAPY_SDR_ERROR, "Afedri record_start: record_path is not set");
+        throw std::runtime_error("Afedri record_start: record_path is not set");
+    }
+
+    // all channels of the device, a file pair per channel
+    std::vector<size_t> channels;
+    std::vector<std::string> bases;
+    for (size_t ch = 0; ch < _num_channels; ch++)
+    {
+        channels.push_back(ch);
+        bases.push_back((_num_channels == 1) ? base : base + "_ch" + std::to_string(ch));
+    }
+
+    // Own stream, so the recording keeps capture running. It reads rings of its own: a shared channel ring is sized by
+    // the streams which were set up first, so it could be shorter than record_ring_ms.
+    SoapySDR::Kwargs args;
+    args["ring_ms"] = record_ring_ms;
+    args["own_ring"] = "1";
+    SoapySDR::Stream *stream = setupStream(SOAPY_SDR_RX, SOAPY_SDR_CS16, channels, args);
+
+    RecordMeta meta;
+    meta.sample_rate = _saved_sample_rate;
+    meta.frequency = _saved_frequency;
+    meta.hw = _version_info.version_string;
+    meta.gains = _saved_gains;
+    std::unique_ptr<IqRecorder> recorder(new IqRecorder(get_stream_context(stream).stream_items, bases, meta));
+    try
+    {
+        recorder->start();
+        activateStream(stream); // own rings are allocated here
+    }
+    catch (std::exception const &ex)
+    {
+        recorder->stop();
+        closeStream(stream);
+        SoapySDR::logf(SOAPY_SDR_ERROR, "Afedri recording: %s", ex.what());
+        throw;
+    }
+
+    // effective size, it is rounded up to whole pages and packets
+    const size_t ring_len = get_stream_context(stream).stream_items[0]->buffer.size();
+    const double ring_ms = (_saved_sample_rate > 0.0) ? ring_len / 2 * 1000.0 / _saved_sample_rate : 0.0;
+    if (ring_len / 2 < static_cast<size_t>(std::stod(record_ring_ms) * _saved_sample_rate / 1000.0))
+    {
+        recorder->stop();
+        closeStream(stream);
+        SoapySDR::logf(SOAPY_SDR_ERROR, "Afedri recording: ring of %d samples (%.0f ms) is shorter than %s ms", (int)(ring_len / 2),
+                       ring_ms, record_ring_ms);
+        throw std::runtime_error("Afedri record_start: can't allocate rings of " + std::string(record_ring_ms) + " ms");
+    }
+    SoapySDR::logf(SOAPY_SDR_INFO, "Afedri recording: ring of %d samples (%.0f ms) per channel", (int)(ring_len / 2), ring_ms);
+
+    _record_stream = stream;
+    _recorder = std::move(recorder);
+    SoapySDR::logf(SOAPY_SDR_INFO, "Afedri recording started: %s, %d channel(s), sample rate %.1f", base.c_str(), (int)_num_channels,
+                   _saved_sample_rate);
+}
+
+void AfedriDevice::stop_recording()
+{
+    std::unique_ptr<IqRecorder> recorder;
+    SoapySDR::Stream *stream = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(_record_mtx);
+        recorder = std::move(_recorder);
+        stream = _record_stream;
+        _record_stream = nullptr;
+    }
+    if (!recorder)
+    {
+        return;
+    }
+
+    recorder->stop(); // writes what is still in rings
+    closeStream(stream);
+
+    SoapySDR::logf(SOAPY_SDR_INFO, "Afedri recording stopped: bytes written=%lld, samples lost=%lld",
+                   (long long)recorder->bytes_written(), (long long)recorder->samples_dropped());
+    if (recorder->write_failed())
+    {
+        SoapySDR::log(SOAPY_SDR_ERROR, "Afedri recording: write to data file failed, the recording is incomplete");
+    }
+}
@@ -7,6 +7,7 @@
 #include <SoapySDR/Logger.hpp>
 #include <SoapySDR/Registry.hpp>
 
+#include <fstream>
 #include <iostream>
 #include <sstream>
 
@@ -29,6 +30,19 @@ struct Params
     int rx_mode{-1};     // not set by default
     int num_channels{0}; // 0 - means must be set automatically
     int map_ch0{-1};     // not active by default
+    std::string rx_engine{"select"};
+    int rx_batch{32};          // datagrams per recvmmsg call
+    int rx_reactor_threads{1}; // threads of shared reactor for rx_engine=reactor
+    int rcvbuf{0};             // socket receive buffer size in bytes, 0 - system default
+    std::string rx_cpu{};      // RX thread CPU list "2,4-7" or mask "0xF0", empty - any
+    std::string rx_priority{}; // RX thread scheduling "fifo:50", "rr:10", empty - default
+    int rx_hugepages{0};       // 1 - stream rings in huge pages
+    int rx_mlock{0};           // 1 - lock stream rings and RX packet buffers in memory
+    int resample{0};           // 1 - resample to sample rates which are not golden rates
+    std::string file{};        // afedri_replay: capture file
+    double rate{0.0};          // afedri_replay: pace, 0 - from SigMF metadata
+    int pace{1};               // afedri_replay: 0 - free running
+    int loop{1};               // afedri_replay: 0 - stop at end of file
 
     std::string make_address_port() const
     {
@@ -39,13 +53,151 @@ struct Params
     {
         std::ostringstream ss;
         ss << "driver=" << driver << " address=" << address << " port=" << port << " bind_address=" << bind_address
-           << " bind_port=" << bind_port << " rx_mode=" << rx_mode << " num_channels=" << num_channels << " map_ch0=" << map_ch0 << "";
+           << " bind_port=" << bind_port << " rx_mode=" << rx_mode << " num_channels=" << num_channels << " map_ch0=" << map_ch0
+           << " rx_engine=" << rx_engine << " rx_batch=" << rx_batch << " rx_reactor_threads=" << rx_reactor_threads
+           << " rcvbuf=" << rcvbuf << " rx_cpu=" << rx_cpu << " rx_priority=" << rx_priority << " rx_hugepages=" << rx_hugepages
+           << " rx_mlock=" << rx_mlock << " resample=" << resample << " file=" << file << " rate=" << rate << " pace=" << pace
+           << " loop=" << loop << "";
         return ss.str();
     }
 
+    UdpRxOptions make_rx_options() const;
+
     static Params make_from_kwargs(const SoapySDR::Kwargs &args);
 };
 
+// Parse CPU list "2,4-7" or hex mask "0xF0".
+static std::vector<int> parse_cpu_list(std::string const &s)
+{
+    std::vector<int> res;
+
+    if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    {
+        const unsigned long long mask = std::stoull(s.substr(2), nullptr, 16);
+        for (int cpu = 0; cpu < 64; cpu++)
+        {
+            if (mask & (1ULL << cpu))
+            {
+                res.push_back(cpu);
+            }
+        }
+        return res;
+    }
+
+    std::istringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        const auto dash = item.find('-');
+        const int first = std::stoi(item.substr(0, dash));
+        const int last = (dash == std::string::npos) ? first : std::stoi(item.substr(dash + 1));
+        if (first < 0 || last < first || last >= 1024)
+        {
+            throw WrongParamsError("rx_cpu has invalid range '" + item + "'");
+        }
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            res.push_back(cpu);
+        }
+    }
+    return res;
+}
+
+UdpRxOptions Params::make_rx_options() const
+{
+    UdpRxOptions res;
+
+    if (rx_engine == "select")
+    {
+        res.engine = UdpRxEngine::Select;
+    }
+    else if (rx_engine == "recvmmsg")
+    {
+        res.engine = UdpRxEngine::RecvMmsg;
+    }
+    else if (rx_engine == "reactor")
+    {
+        res.engine = UdpRxEngine::Reactor;
+    }
+    else if (rx_engine == "io_uring")
+    {
+        res.engine = UdpRxEngine::IoUring;
+    }
+    else
+    {
+        throw WrongParamsError("Unknown rx_engine '" + rx_engine + "'. Possible values: select, recvmmsg, reactor, io_uring");
+    }
+
+    if (rx_batch < 1 || rx_batch > 1024)
+    {
+        throw WrongParamsError("rx_batch must be in range [1,1024]");
+    }
+    res.batch_size = static_cast<size_t>(rx_batch);
+
+    if (rx_reactor_threads < 1 || rx_reactor_threads > 64)
+    {
+        throw WrongParamsError("rx_reactor_threads must be in range [1,64]");
+    }
+    res.reactor_threads = static_cast<size_t>(rx_reactor_threads);
+
+    if (rcvbuf < 0)
+    {
+        throw WrongParamsError("rcvbuf must not be negative");
+    }
+    res.rcvbuf = rcvbuf;
+
+    if (!rx_cpu.empty())
+    {
+        try
+        {
+            res.cpus = parse_cpu_list(rx_cpu);
+        }
+        catch (std::logic_error &)
+        {
+            throw WrongParamsError("rx_cpu must be CPU list like '2,4-7' or mask like '0xF0'");
+        }
+    }
+
+    if (!rx_priority.empty())
+    {
+        // "fifo:50", "rr:10" or just priority "50" which means fifo
+        const auto colon = rx_priority.find(':');
+        const std::string policy = (colon == std::string::npos) ? "fifo" : rx_priority.substr(0, colon);
+        const std::string level = (colon == std::string::npos) ? rx_priority : rx_priority.substr(colon + 1);
+
+        if (policy == "fifo")
+        {
+            res.sched = UdpRxSched::Fifo;
+        }
+        else if (policy == "rr")
+        {
+            res.sched = UdpRxSched::RoundRobin;
+        }
+        else
+        {
+            throw WrongParamsError("Unknown rx_priority policy '" + policy + "'. Possible values: fifo, rr");
+        }
+
+        try
+        {
+            res.sched_priority = std::stoi(level);
+        }
+        catch (std::logic_error &)
+        {
+            res.sched_priority = 0; // reported below
+        }
+        if (res.sched_priority < 1 || res.sched_priority > 99)
+        {
+            throw WrongParamsError("rx_priority level must be in range [1,99]");
+        }
+    }
+
+    res.huge_pages = rx_hugepages != 0;
+    res.lock_memory = rx_mlock != 0;
+
+    return res;
+}
+
 Params Params::make_from_kwargs(const SoapySDR::Kwargs &args)
 {
     Params res;
@@ -91,6 +243,71 @@ Params Params::make_from_kwargs(const SoapySDR::Kwargs &args)
         res.map_ch0 = std::stoi(args.at("map_ch0"));
     }
 
+    if (args.count("rx_engine"))
+    {
+        res.rx_engine = args.at("rx_engine");
+    }
+
+    if (args.count("rx_batch"))
+    {
+        res.rx_batch = std::stoi(args.at("rx_batch"));
+    }
+
+    if (args.count("rx_reactor_threads"))
+    {
+        res.rx_reactor_threads = std::stoi(args.at("rx_reactor_threads"));
+    }
+
+    if (args.count("rcvbuf"))
+    {
+        res.rcvbuf = std::stoi(args.at("rcvbuf"));
+    }
+
+    if (args.count("rx_cpu"))
+    {
+        res.rx_cpu = args.at("rx_cpu");
+    }
+
+    if (args.count("rx_priority"))
+    {
+        res.rx_priority = args.at("rx_priority");
+    }
+
+    if (args.count("rx_hugepages"))
+    {
+        res.rx_hugepages = std::stoi(args.at("rx_hugepages"));
+    }
+
+    if (args.count("rx_mlock"))
+    {
+        res.rx_mlock = std::stoi(args.at("rx_mlock"));
+    }
+
+    if (args.count("resample"))
+    {
+        res.resample = std::stoi(args.at("resample"));
+    }
+
+    if (args.count("file"))
+    {
+        res.file = args.at("file");
+    }
+
+    if (args.count("rate"))
+    {
+        res.rate = std::stod(args.at("rate"));
+    }
+
+    if (args.count("pace"))
+    {
+        res.pace = std::stoi(args.at("pace"));
+    }
+
+    if (args.count("loop"))
+    {
+        res.loop = std::stoi(args.at("loop"));
+    }
+
     return res;
 }
 
@@ -155,7 +372,7 @@ SoapySDR::KwargsList findMyDevice(const SoapySDR::Kwargs &args)
         {
             SoapySDR::logf(SOAPY_SDR_INFO, "Afedri driver: Force try to make device for params: %s", params.as_debug_string().c_str());
             AfedriDevice ad(params.address, params.port, params.bind_address, params.bind_port, params.rx_mode, params.num_channels,
-                            params.map_ch0);
+                            params.map_ch0, params.make_rx_options());
             auto m = SoapySDR::Kwargs();
             auto label = std::string("afedri :: " + params.make_address_port());
             m["label"] = label;
@@ -200,10 +417,143 @@ SoapySDR::Device *makeMyDevice(const SoapySDR::Kwargs &args)
     SoapySDR::logf(SOAPY_SDR_INFO, "Afedri driver: Making device for params: %s", params.as_debug_string().c_str());
 
     return new AfedriDevice(params.address, params.port, params.bind_address, params.bind_port, params.rx_mode, params.num_channels,
-                            params.map_ch0);
+                            params.map_ch0, params.make_rx_options(), params.resample != 0);
+}
+
+/***********************************************************************
+ * Replay device: capture file instead of hardware
+ **********************************************************************/
+// `<base>.sigmf-meta` for `<base>.sigmf-data`, `<file>.sigmf-meta` for anything else
+static std::string replay_meta_path(std::string const &file)
+{
+    const std::string data_ext = ".sigmf-data";
+    if (file.size() > data_ext.size() && file.compare(file.size() - data_ext.size(), data_ext.size(), data_ext) == 0)
+    {
+        return file.substr(0, file.size() - data_ext.size()) + ".sigmf-meta";
+    }
+    return file + ".sigmf-meta";
+}
+
+// IqRecorder writes a recording of several channels as `<base>_ch<N>.sigmf-data` files. `file` may name any of them
+// or `<base>`. Returns data files of all channels, empty if there is no such recording.
+static std::vector<std::string> recorded_channel_files(std::string const &file)
+{
+    std::string base = file;
+    for (std::string const ext : {".sigmf-data", ".sigmf-meta"})
+    {
+        if (base.size() > ext.size() && base.compare(base.size() - ext.size(), ext.size(), ext) == 0)
+        {
+            base.resize(base.size() - ext.size());
+            break;
+        }
+    }
+    const size_t suffix = base.rfind("_ch");
+    if (suffix != std::string::npos && suffix + 3 < base.size() &&
+        base.find_first_not_of("0123456789", suffix + 3) == std::string::npos)
+    {
+        base.resize(suffix);
+    }
+
+    std::vector<std::string> files;
+    for (size_t channel = 0;; channel++)
+    {
+        const std::string path = base + "_ch" + std::to_string(channel) + ".sigmf-data";
+        if (!std::ifstream(path))
+        {
+            break;
+        }
+        files.push_back(path);
+    }
+    if (files.size() < 2)
+    {
+        files.clear(); // a single channel recording has no suffix
+    }
+    return files;
+}
+
+SoapySDR::KwargsList findReplayDevice(const SoapySDR::Kwargs &args)
+{
+    auto res = SoapySDR::KwargsList();
+
+    // never discovered, only made for the given file
+    if (args.count("file") != 0)
+    {
+        auto m = SoapySDR::Kwargs();
+        m["label"] = "afedri replay :: " + args.at("file");
+        m["file"] = args.at("file");
+        res.push_back(m);
+    }
+
+    return res;
+}
+
+SoapySDR::Device *makeReplayDevice(const SoapySDR::Kwargs &args)
+{
+    auto params = Params::make_from_kwargs(args);
+    SoapySDR::logf(SOAPY_SDR_INFO, "Afedri driver: Making replay device for params: %s", params.as_debug_string().c_str());
+    if (params.file.empty())
+    {
+        throw std::runtime_error("Unable to create Afedri replay device without file");
+    }
+
+    ReplayOptions replay;
+    replay.file = params.file;
+    replay.channel_files = recorded_channel_files(params.file);
+
+    RecordMeta meta;
+    size_t num_channels = 1;
+    if (!replay.channel_files.empty())
+    {
+        // a file per channel: metadata of every file is needed to line them up
+        for (size_t channel = 0; channel < replay.channel_files.size(); channel++)
+        {
+            RecordMeta channel_meta;
+            size_t file_channels = 1;
+            if (!read_record_meta(replay_meta_path(replay.channel_files[channel]), channel_meta, file_channels) ||
+                channel_meta.captures.empty())
+            {
+                throw WrongParamsError("Afedri replay: no SigMF captures for " + replay.channel_files[channel] +
+                                       ", channel files can't be lined up");
+            }
+            replay.captures.push_back(channel_meta.captures);
+            if (channel == 0)
+            {
+                meta = channel_meta;
+            }
+        }
+        num_channels = replay.channel_files.size();
+        if (params.num_channels != 0 && static_cast<size_t>(params.num_channels) != num_channels)
+        {
+            throw WrongParamsError("num_channels of replay doesn't match " + std::to_string(num_channels) + " channel files");
+        }
+        SoapySDR::logf(SOAPY_SDR_INFO, "Afedri replay: recording with a file per channel, %d channels", (int)num_channels);
+    }
+    else if (!read_record_meta(replay_meta_path(params.file), meta, num_channels))
+    {
+        SoapySDR::logf(SOAPY_SDR_INFO, "Afedri replay: no SigMF metadata for %s, rate and num_channels args are used", params.file.c_str());
+    }
+    if (params.num_channels != 0)
+    {
+        num_channels = static_cast<size_t>(params.num_channels);
+    }
+    if (num_channels != 1 && num_channels != 2 && num_channels != 4)
+    {
+        throw WrongParamsError("num_channels of replay must be 1, 2 or 4");
+    }
+
+    replay.sample_rate = (params.rate > 0.0) ? params.rate : meta.sample_rate;
+    replay.paced = params.pace != 0;
+    replay.loop = params.loop != 0;
+    if (replay.sample_rate <= 0.0)
+    {
+        SoapySDR::log(SOAPY_SDR_WARNING, "Afedri replay: sample rate is unknown, replay is free running until setSampleRate");
+    }
+
+    return new AfedriDevice(replay, meta, static_cast<int>(num_channels), params.make_rx_options());
 }
 
 /***********************************************************************
  * Registration
  **********************************************************************/
 static SoapySDR::Registry registerMyDevice("afedri", &findMyDevice, &makeMyDevice, SOAPY_SDR_ABI_VERSION);
+static SoapySDR::Registry registerReplayDevice("afedri_replay", &findReplayDevice, &makeReplayDevice, SOAPY_SDR_ABI_VERSION);
@@ -8,25 +8,141 @@
 #include "afedri_control.hpp"
 #include "udp_rx.hpp"
 
+#include <cmath>
+
+constexpr std::uint64_t max_interpolation = 256; // polyphase branches of resampler, each has its own taps
+
+static std::uint64_t gcd(std::uint64_t a, std::uint64_t b)
+{
+    while (b != 0)
+    {
+        const std::uint64_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+// Find hardware rate quartz / (4 * divider) above `samp_rate` with exact ratio samp_rate / hardware rate = l / m.
+// The lowest such rate with not too many polyphase branches is used. Returns false if there is no one.
+static bool find_resampling(std::uint32_t quartz, std::uint32_t samp_rate, std::uint32_t &divider, size_t &l, size_t &m)
+{
+    if (samp_rate == 0)
+    {
+        return false;
+    }
+
+    for (std::uint32_t div = quartz / 4 / samp_rate; div >= 8; div--)
+    {
+        const std::uint64_t num = 4ull * div * samp_rate;
+        const std::uint64_t g = gcd(num, quartz);
+        if (num / g <= max_interpolation)
+        {
+            divider = div;
+            l = static_cast<size_t>(num / g);
+            m = static_cast<size_t>(quartz / g);
+            return true;
+        }
+    }
+    return false;
+}
+
+// DDC and resampler of an active stream are made for the rates at activateStream and are used by the reading thread without
+// a lock, so they are not rebuilt here. Throws if the new hardware rate or resampling ratio doesn't fit an active stream:
+// its processors would give a wrong rate, or a plain I+Q stream would give the hardware rate instead of the requested one.
+void AfedriDevice::check_rate_change(double hw_rate, size_t resample_l, size_t resample_m)
+{
+    const bool same_hw_rate = hw_rate == _saved_sample_rate;
+    const bool same_resampling = resample_l == _resample_l && resample_m == _resample_m;
+    {
+        std::unique_lock<std::mutex> lock(_record_mtx);
+        if (_recorder && !same_hw_rate)
+        {
+            SoapySDR::log(SOAPY_SDR_ERROR, "Afedri setSampleRate: hardware rate can't change while recording");
+            throw std::runtime_error("Afedri setSampleRate: hardware rate can't change while recording, stop it first");
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(_streams_protect_mtx);
+    for (auto const &item : _configured_streams)
+    {
+        StreamContext const &stream_context = item.second;
+        if (!stream_context.active)
+        {
+            continue;
+        }
+        const bool has_processors = !stream_context.processors.empty();
+        const bool plain_iq = !has_processors && stream_context.fft_size == 0;
+        if ((has_processors && !(same_hw_rate && same_resampling)) || (plain_iq && resample_l != 0))
+        {
+            SoapySDR::logf(SOAPY_SDR_ERROR, "Afedri setSampleRate: stream_id=%d is active", stream_context.stream_id);
+            throw std::runtime_error("Afedri setSampleRate: the new rate needs DDC or resampler of active stream_id=" +
+                                     std::to_string(stream_context.stream_id) + " rebuilt, deactivate it first");
+        }
+    }
+}
+
 void AfedriDevice::setSampleRate(const int /* direction */, const size_t channel, const double rate)
 {
+    if (!_afedri_control)
+    {
+        // replay device: the rate is pace of replay
+        check_rate_change(rate, 0, 0);
+        _udp_rx_thread_defer->get_ctx()->replay_rate.store(rate);
+        _saved_sample_rate = rate;
+        SoapySDR_logf(SOAPY_SDR_INFO, "Afedri: Set replay sample rate as %.0f", rate);
+        return;
+    }
+
     const std::uint32_t samp_rate = (std::uint32_t)rate;
 
     const auto ch = AfedriControl::make_afedri_channel_from_0based_index(remap_channel(channel));
 
-    _afedri_control.set_sample_rate(ch, samp_rate);
-
     const std::uint32_t quartz = _version_info.main_clock_frequency; // For me it was 76_800_000
+
+    // Not a golden rate: run hardware at a higher rate and resample I+Q streams down to the requested rate.
+    std::uint32_t divider = 0;
+    size_t l = 0;
+    size_t m = 0;
+    if (_resample && AfedriControl::calc_actual_sample_rate(quartz, samp_rate) != samp_rate &&
+        !find_resampling(quartz, samp_rate, divider, l, m))
+    {
+        SoapySDR_logf(SOAPY_SDR_WARNING, "Afedri: no resampling ratio for sample rate %d, quartz=%d", samp_rate, quartz);
+    }
+
+    if (l != 0 && l != m)
+    {
+        const double hw_rate = (double)quartz / (4.0 * (double)divider);
+        check_rate_change(hw_rate, l, m);
+        _afedri_control->set_sample_rate(ch, (std::uint32_t)std::lround(hw_rate));
+        SoapySDR_logf(SOAPY_SDR_INFO, "Afedri: Set sample rate as %d, hardware sample rate %.3f resampled by %d/%d, quartz=%d", samp_rate,
+                      hw_rate, (int)l, (int)m, quartz);
+
+        _saved_sample_rate = hw_rate;
+        _resample_l = l;
+        _resample_m = m;
+        _resampled_rate = (double)samp_rate;
+        return;
+    }
+
     const std::uint32_t actual_samp_rate = AfedriControl::calc_actual_sample_rate(quartz, samp_rate);
+    check_rate_change((double)actual_samp_rate, 0, 0);
+
+    _afedri_control->set_sample_rate(ch, samp_rate);
     auto level = (actual_samp_rate == samp_rate) ? SOAPY_SDR_INFO : SOAPY_SDR_WARNING;
     SoapySDR_logf(level, "Afedri: Set sample rate as %d, actual sample rate will be %d, quartz=%d", samp_rate, actual_samp_rate, quartz);
 
     _saved_sample_rate = (double)actual_samp_rate;
+    _resample_l = 0;
+    _resample_m = 0;
+    _resampled_rate = 0.0;
 }
 
+// Rate of plain I+Q streams. DDC streams give rx_hardware_rate / ddc_decim, spectrum streams and recordings take
+// samples at rx_hardware_rate.
 double AfedriDevice::getSampleRate(const int /* direction */, const size_t /* channel */) const
 {
-    return _saved_sample_rate;
+    return (_resample_l != 0) ? _resampled_rate : _saved_sample_rate;
 }
 
 static void fill_golden_sample_rates76M8(std::vector<double> &results)
@@ -97,7 +213,14 @@ std::vector<double> AfedriDevice::listSampleRates(const int /* direction */, con
 {
     std::vector<double> results;
 
-    if (_version_info.main_clock_frequency == 80000000)
+    if (!_afedri_control)
+    {
+        if (_saved_sample_rate > 0.0)
+        {
+            results.push_back(_saved_sample_rate); // rate of the recording
+        }
+    }
+    else if (_version_info.main_clock_frequency == 80000000)
     {
         fill_golden_sample_rates80M0(results);
     }
@@ -116,6 +239,11 @@ std::vector<double> AfedriDevice::listSampleRates(const int /* direction */, con
 SoapySDR::RangeList AfedriDevice::getSampleRateRange(const int /* direction */, const size_t /* channel */) const
 {
     SoapySDR::RangeList results;
+    if (!_afedri_control)
+    {
+        results.push_back(SoapySDR::Range(1e3, 100e6)); // replay device: any pace
+        return results;
+    }
     results.push_back(SoapySDR::Range(48e3, 2.4e6));
     return results;
 }
@@ -130,7 +258,7 @@ double AfedriDevice::getBandwidth(const int /* direction */, const size_t /* cha
 {
     if (_saved_bandwidth == 0.0)
     {
-        return _saved_sample_rate;
+        return getSampleRate(SOAPY_SDR_RX, 0);
     }
 
     return _saved_bandwidth;
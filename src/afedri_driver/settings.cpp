@@ -34,6 +34,7 @@ std::vector<std::string> AfedriDevice::getStreamFormats(const int /* direction *
 
     formats.push_back(SOAPY_SDR_CS16);
     formats.push_back(SOAPY_SDR_CF32);
+    formats.push_back(SOAPY_SDR_F32); // averaged power spectrum in dB, see fft_* stream args
 
     return formats;
 }
@@ -60,6 +61,140 @@ SoapySDR::ArgInfoList AfedriDevice::getStreamArgsInfo(const int direction, const
 
     SoapySDR::ArgInfoList streamArgs;
 
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "ring_samples";
+        arg.value = "0";
+        arg.name = "Ring size";
+        arg.description = "Buffer size of each channel in samples. 0 - default (512K samples)";
+        arg.units = "samples";
+        arg.type = SoapySDR::ArgInfo::INT;
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "ring_ms";
+        arg.value = "0";
+        arg.name = "Ring duration";
+        arg.description = "Buffer size of each channel in milliseconds at sample rate set on activation. Ignored if ring_samples is set";
+        arg.units = "ms";
+        arg.type = SoapySDR::ArgInfo::FLOAT;
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "own_ring";
+        arg.value = "0";
+        arg.name = "Own ring";
+        arg.description = "1 - don't share the channel ring with other streams, the stream gets a ring of its own in the requested size";
+        arg.type = SoapySDR::ArgInfo::BOOL;
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "overflow";
+        arg.value = "drop_oldest";
+        arg.name = "Overflow policy";
+        arg.description = "What to do when buffer is full: drop_oldest (minimum latency), drop_newest (keep queued data), "
+                          "block (keep queued data, buffer has overflow_wait_ms of extra room)";
+        arg.type = SoapySDR::ArgInfo::STRING;
+        arg.options = {"drop_oldest", "drop_newest", "block"};
+        arg.optionNames = {"Drop oldest", "Drop newest", "Block"};
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "overflow_wait_ms";
+        arg.value = "100";
+        arg.name = "Overflow wait";
+        arg.description = "overflow=block: extra buffer, the reader may stall that long without loss";
+        arg.units = "ms";
+        arg.type = SoapySDR::ArgInfo::FLOAT;
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "min_elems";
+        arg.value = "0";
+        arg.name = "Wake-up threshold";
+        arg.description = "readStream sleeps until this number of samples is buffered, 0 - numElems of the call";
+        arg.units = "samples";
+        arg.type = SoapySDR::ArgInfo::INT;
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "wakeup_ms";
+        arg.value = "0";
+        arg.name = "Wake-up latency";
+        arg.description = "Max wait for the wake-up threshold, then readStream returns buffered samples, 0 - read timeout";
+        arg.units = "ms";
+        arg.type = SoapySDR::ArgInfo::FLOAT;
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "ddc_offset";
+        arg.value = "0";
+        arg.name = "DDC offset";
+        arg.description = "Center of the sub-band relative to center frequency, shifted to 0 Hz by driver-side DDC";
+        arg.units = "Hz";
+        arg.type = SoapySDR::ArgInfo::FLOAT;
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "ddc_decim";
+        arg.value = "1";
+        arg.name = "DDC decimation";
+        arg.description = "Stream sample rate is divided by this value after low-pass filter, 1 - no decimation";
+        arg.type = SoapySDR::ArgInfo::INT;
+        arg.range = SoapySDR::Range(1, 1024);
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "fft_size";
+        arg.value = "1024";
+        arg.name = "FFT size";
+        arg.description = "Spectrum stream (format F32): number of bins in a frame, power of 2";
+        arg.type = SoapySDR::ArgInfo::INT;
+        arg.range = SoapySDR::Range(16, 65536);
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "fft_avg";
+        arg.value = "10";
+        arg.name = "FFT averaging";
+        arg.description = "Spectrum stream (format F32): number of transforms averaged in a frame";
+        arg.type = SoapySDR::ArgInfo::INT;
+        arg.range = SoapySDR::Range(1, 100000);
+        streamArgs.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "fft_window";
+        arg.value = "hann";
+        arg.name = "FFT window";
+        arg.description = "Spectrum stream (format F32): window function";
+        arg.type = SoapySDR::ArgInfo::STRING;
+        arg.options = {"hann", "blackman_harris", "rect"};
+        arg.optionNames = {"Hann", "Blackman-Harris", "Rectangular"};
+        streamArgs.push_back(arg);
+    }
+
     return streamArgs;
 }
 
@@ -110,6 +245,101 @@ SoapySDR::ArgInfoList AfedriDevice::getSettingInfo(void) const
         }
     }
 
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "rx_packets_lost";
+        arg.value = "0";
+        arg.name = "RX packets lost";
+        arg.description = "Number of UDP packets lost in network (read only)";
+        arg.type = SoapySDR::ArgInfo::INT;
+        arg_list.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "rx_kernel_drops";
+        arg.value = "0";
+        arg.name = "RX kernel drops";
+        arg.description = "Number of UDP packets dropped by kernel due to full socket receive buffer, Linux only (read only)";
+        arg.type = SoapySDR::ArgInfo::INT;
+        arg_list.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "rx_hardware_rate";
+        arg.value = "0";
+        arg.name = "RX hardware rate";
+        arg.description = "Sample rate of the hardware, given by DDC input, spectrum and recording; differs from getSampleRate "
+                          "only with resample=1 (read only)";
+        arg.units = "Hz";
+        arg.type = SoapySDR::ArgInfo::FLOAT;
+        arg_list.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "rx_rcvbuf";
+        arg.value = "0";
+        arg.name = "RX socket buffer";
+        arg.description = "Socket receive buffer size granted by kernel (read only)";
+        arg.units = "bytes";
+        arg.type = SoapySDR::ArgInfo::INT;
+        arg_list.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "record_path";
+        arg.value = "";
+        arg.name = "Record path";
+        arg.description = "Base name of SigMF recording: <path>.sigmf-data/.sigmf-meta, <path>_ch<N>.* for several channels";
+        arg.type = SoapySDR::ArgInfo::STRING;
+        arg_list.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "record_start";
+        arg.value = "";
+        arg.name = "Start recording";
+        arg.description = "Start raw CS16 recording of all channels to record_path (write any value)";
+        arg.type = SoapySDR::ArgInfo::STRING;
+        arg_list.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "record_stop";
+        arg.value = "";
+        arg.name = "Stop recording";
+        arg.description = "Stop recording and finish SigMF metadata (write any value)";
+        arg.type = SoapySDR::ArgInfo::STRING;
+        arg_list.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "record_bytes";
+        arg.value = "0";
+        arg.name = "Recorded bytes";
+        arg.description = "Bytes written by the running recording, all channels (read only)";
+        arg.units = "bytes";
+        arg.type = SoapySDR::ArgInfo::INT;
+        arg_list.push_back(arg);
+    }
+
+    {
+        SoapySDR::ArgInfo arg;
+        arg.key = "record_dropped";
+        arg.value = "0";
+        arg.name = "Recording loss";
+        arg.description = "Samples the running recording lost because the disk was too slow, all channels (read only)";
+        arg.units = "samples";
+        arg.type = SoapySDR::ArgInfo::INT;
+        arg_list.push_back(arg);
+    }
+
     return arg_list;
 }
 
@@ -120,13 +350,29 @@ void AfedriDevice::writeSetting(const std::string &key, const std::string &value
     const auto afedri_channel = AfedriControl::make_afedri_channel_from_0based_index(remap_channel(0)); // TODO: check channel index
     _saved_settings[key] = value;
 
-    if (lower_key == "r820t_lna_agc")
+    if (!_afedri_control && (lower_key == "r820t_lna_agc" || lower_key == "r820t_mixer_agc"))
+    {
+        // replay device, nothing to tune
+    }
+    else if (lower_key == "r820t_lna_agc")
     {
-        _afedri_control.set_r820t_lna_agc(afedri_channel, str2boolint(value));
+        _afedri_control->set_r820t_lna_agc(afedri_channel, str2boolint(value));
     }
     else if (lower_key == "r820t_mixer_agc")
     {
-        _afedri_control.set_r820t_mixer_agc(afedri_channel, str2boolint(value));
+        _afedri_control->set_r820t_mixer_agc(afedri_channel, str2boolint(value));
+    }
+    else if (lower_key == "record_path")
+    {
+        _saved_settings["record_path"] = value; // used by record_start
+    }
+    else if (lower_key == "record_start")
+    {
+        start_recording();
+    }
+    else if (lower_key == "record_stop")
+    {
+        stop_recording();
     }
     else
     {
@@ -136,6 +382,33 @@ void AfedriDevice::writeSetting(const std::string &key, const std::string &value
 
 std::string AfedriDevice::readSetting(const std::string &key) const
 {
+    const std::string lower_key = to_lower(key);
+    if (lower_key == "rx_packets_lost")
+    {
+        return std::to_string(_udp_rx_thread_defer->get_ctx()->packets_lost.load());
+    }
+    else if (lower_key == "rx_kernel_drops")
+    {
+        return std::to_string(_udp_rx_thread_defer->get_ctx()->kernel_drops.load());
+    }
+    else if (lower_key == "rx_rcvbuf")
+    {
+        return std::to_string(_udp_rx_thread_defer->get_ctx()->rcvbuf_granted);
+    }
+    else if (lower_key == "rx_hardware_rate")
+    {
+        return std::to_string(_saved_sample_rate);
+    }
+    else if (lower_key == "record_bytes" || lower_key == "record_dropped")
+    {
+        std::unique_lock<std::mutex> lock(_record_mtx);
+        if (!_recorder)
+        {
+            return "0";
+        }
+        return std::to_string((lower_key == "record_bytes") ? _recorder->bytes_written() : _recorder->samples_dropped());
+    }
+
     auto it = _saved_settings.find(key);
     if (it == _saved_settings.end())
     {
@@ -3,21 +3,51 @@
 #pragma once
 
 #include <SoapySDR/Device.hpp>
+#include <SoapySDR/Version.hpp>
+
+#include <complex>
 
 #include "afedri_control.hpp"
+#include "ddc.hpp"
+#include "recorder.hpp"
+#include "resampler.hpp"
+#include "spectrum.hpp"
 #include "udp_rx.hpp"
 
+// Stream handle given to application by setupStream. Lives in _configured_streams until closeStream.
 struct StreamContext
 {
-    StreamContext() = default;
-    StreamContext(std::vector<size_t> channels, std::string format, bool active)
-        : channels(std::move(channels)), format(std::move(format)), active(active)
+    StreamContext(int stream_id, std::vector<size_t> channels, std::string format)
+        : stream_id(stream_id), channels(std::move(channels)), format(std::move(format)), active(false)
     {
     }
+    StreamContext(StreamContext const &) = delete;
+    StreamContext &operator=(StreamContext const &) = delete;
 
+    int stream_id;
     std::vector<size_t> channels;
     std::string format;
     bool active;
+    std::vector<StreamItem *> stream_items; // one per channel, StreamItem is never moved while UDP RX context exists
+    size_t ring_samples{0};                 // ring size from stream args, 0 - not set
+    double ring_ms{0.0};                    // ring size in milliseconds from stream args, 0 - not set
+    OverflowPolicy overflow_policy{OverflowPolicy::DropOldest};
+    bool own_ring{false};      // `own_ring` stream arg: don't share the channel ring, e.g. to get the requested ring size for sure
+    bool direct_access{false}; // application asked for direct buffer access, then the stream reads rings of its own
+    std::chrono::microseconds overflow_wait{100000}; // OverflowPolicy::Block: stall of the reader its ring takes without loss
+    size_t min_elems{0};                             // samples to wake up readStream, 0 - numElems of the call
+    std::chrono::microseconds wakeup_latency{std::chrono::microseconds::max()}; // max wait for min_elems, default - read timeout
+    std::vector<std::uint64_t> read_positions{}; // readStream of several channels only, aligned positions of channels
+    double ddc_offset{0.0};                      // DDC: center of the sub-band relative to center frequency, Hz
+    size_t ddc_decim{1};                         // DDC: decimation, with zero offset 1 means no DDC
+    std::vector<std::unique_ptr<SampleProcessor>> processors{}; // DDC or resampler of every channel, created at activateStream
+    size_t fft_size{0};                          // spectrum stream (format F32): FFT size, 0 - I+Q stream
+    size_t fft_avg{1};                           // spectrum stream: transforms averaged in one frame
+    SpectrumWindow fft_window{SpectrumWindow::Hann};
+    std::vector<std::unique_ptr<Spectrum>> spectrum{}; // spectrum of every channel, created at activateStream
+    size_t frame_pos{0};                         // spectrum stream: bins of the last frame already given to application
+    long long frame_time_ns{0};                  // spectrum stream: receive time of the first sample of the frame
+    bool frame_has_time{false};
 };
 
 /***********************************************************************
@@ -27,7 +57,10 @@ class AfedriDevice : public SoapySDR::Device
 {
   public:
     AfedriDevice(std::string const &address, int port, std::string const &bind_address, int bind_port, int afedri_mode, int num_channels,
-                 int map_ch0);
+                 int map_ch0, UdpRxOptions const &rx_options = UdpRxOptions(), bool resample = false);
+    // Replay device: no hardware, streams are fed from the capture file `replay.file` described by `meta`.
+    AfedriDevice(ReplayOptions const &replay, RecordMeta const &meta, int num_channels, UdpRxOptions const &rx_options = UdpRxOptions());
+    ~AfedriDevice() override;
 
     std::string getDriverKey(void) const override;
 
@@ -121,6 +154,19 @@ class AfedriDevice : public SoapySDR::Device
     int readStream(SoapySDR::Stream *stream, void *const *buffs, const size_t numElems, int &flags, long long &timeNs,
                    const long timeoutUs = 100000) override;
 
+    /*******************************************************************
+     * Direct buffer access API
+     ******************************************************************/
+
+    size_t getNumDirectAccessBuffers(SoapySDR::Stream *stream) override;
+
+    int getDirectAccessBufferAddrs(SoapySDR::Stream *stream, const size_t handle, void **buffs) override;
+
+    int acquireReadBuffer(SoapySDR::Stream *stream, size_t &handle, const void **buffs, int &flags, long long &timeNs,
+                          const long timeoutUs = 100000) override;
+
+    void releaseReadBuffer(SoapySDR::Stream *stream, const size_t handle) override;
+
     /*******************************************************************
      * Antenna API
      ******************************************************************/
@@ -130,6 +176,35 @@ class AfedriDevice : public SoapySDR::Device
 
     std::string getAntenna(const int direction, const size_t channel) const override;
 
+    /*******************************************************************
+     * Frontend corrections API
+     ******************************************************************/
+    bool hasDCOffsetMode(const int direction, const size_t channel) const override;
+
+    void setDCOffsetMode(const int direction, const size_t channel, const bool automatic) override;
+
+    bool getDCOffsetMode(const int direction, const size_t channel) const override;
+
+    bool hasDCOffset(const int direction, const size_t channel) const override;
+
+    void setDCOffset(const int direction, const size_t channel, const std::complex<double> &offset) override;
+
+    std::complex<double> getDCOffset(const int direction, const size_t channel) const override;
+
+    bool hasIQBalance(const int direction, const size_t channel) const override;
+
+    void setIQBalance(const int direction, const size_t channel, const std::complex<double> &balance) override;
+
+    std::complex<double> getIQBalance(const int direction, const size_t channel) const override;
+
+#ifdef SOAPY_SDR_API_HAS_IQ_BALANCE_MODE
+    bool hasIQBalanceMode(const int direction, const size_t channel) const override;
+
+    void setIQBalanceMode(const int direction, const size_t channel, const bool automatic) override;
+
+    bool getIQBalanceMode(const int direction, const size_t channel) const override;
+#endif
+
     /*******************************************************************
      * Settings API
      ******************************************************************/
@@ -143,30 +218,46 @@ class AfedriDevice : public SoapySDR::Device
     AfedriControl::VersionInfo const &get_version_info() const;
 
   protected:
-    StreamContext &get_stream_context_by_id(int stream_id);
+    static StreamContext &get_stream_context(SoapySDR::Stream *stream);
+    void allocate_stream_buffers(StreamContext &stream_context);
+    void enable_direct_access(StreamContext &stream_context);
 
   private:
     size_t remap_channel(size_t soapy_incoming_channel) const;
+    IqCorrector &channel_correction(size_t channel) const; // correction of the hardware channel of soapy channel
+    void start_recording();
+    void stop_recording();
+    void check_rate_change(double hw_rate, size_t resample_l, size_t resample_m);
 
-    AfedriControl _afedri_control;
+    std::unique_ptr<AfedriControl> _afedri_control; // nullptr for replay device
     std::string _bind_address;
     int _bind_port;
 
     int _afedri_rx_mode;  // [0,5] (Single/DualDiversity/Dual/DiversityInternal/QuadDiversity/Quad)
     size_t _num_channels; // can be 1,2 or 4.
     int _map_ch0;         // -1 if remap is not active
+    UdpRxOptions _rx_options;
+    bool _resample;              // run hardware at a higher rate and resample I+Q streams to requested rate
+    size_t _resample_l{0};       // resampling ratio of requested rate to _saved_sample_rate, 0 - not resampled
+    size_t _resample_m{0};
+    double _resampled_rate{0.0}; // requested rate given by I+Q streams
 
     std::mutex _streams_protect_mtx; // protection for _configured_streams
     int _stream_sequence_provider;
-    std::map<int, StreamContext> _configured_streams;
+    std::map<int, StreamContext> _configured_streams; // node based, so a pointer to StreamContext is a stable stream handle
 
     std::map<std::string, double> _saved_gains;
     double _saved_frequency;
-    double _saved_sample_rate;
+    double _saved_sample_rate; // hardware sample rate, rate of the rings
     double _saved_bandwidth;
     std::string _saved_antenna;
+    std::map<size_t, std::complex<double>> _saved_iq_balance; // by soapy channel
     std::map<std::string, std::string> _saved_settings;
 
     std::unique_ptr<UdpRxContextDefer> _udp_rx_thread_defer;
     AfedriControl::VersionInfo _version_info;
+
+    mutable std::mutex _record_mtx;           // protection for _recorder and _record_stream
+    std::unique_ptr<IqRecorder> _recorder;    // writer of raw recording, see record_* settings
+    SoapySDR::Stream *_record_stream{nullptr}; // own stream of the recorder
 };
@@ -6,10 +6,15 @@
 #include <SoapySDR/Logger.hpp>
 
 #include "afedri_control.hpp"
+#include "dot_product.hpp"
+#include "sample_convert.hpp"
 #include "udp_rx.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <sstream>
+#include <tuple>
 
 // we have this due to lack of support std find_if in c++14
 static StreamsWithinChannel::iterator my_find_if(StreamsWithinChannel::iterator first, StreamsWithinChannel::iterator last,
@@ -24,8 +29,443 @@ static StreamsWithinChannel::iterator my_find_if(StreamsWithinChannel::iterator
     return last;
 }
 
+// Returns true once after any channel of the stream lost data.
+static bool take_overflow(StreamContext const &stream_context)
+{
+    bool res = false;
+    for (StreamItem *stream_item : stream_context.stream_items)
+    {
+        res |= stream_item->take_overflow(); // check all to clear them all
+    }
+    return res;
+}
+
+static bool has_ddc(StreamContext const &stream_context)
+{
+    return stream_context.ddc_decim > 1 || stream_context.ddc_offset != 0.0;
+}
+
+// Zero copy access gives packets of the ring as they are, at hardware sample rate.
+static bool direct_access_supported(StreamContext const &stream_context, bool resampling)
+{
+    return stream_context.format == SOAPY_SDR_CS16 && !has_ddc(stream_context) && !resampling;
+}
+
+// Create DDC or resampler of every channel of the stream. The DDC offset is converted to NCO frequency with the hardware
+// sample rate. I+Q streams without DDC are resampled by `resample_l`/`resample_m`, 0 - not resampled.
+static bool create_processors(StreamContext &stream_context, double sample_rate, size_t resample_l, size_t resample_m)
+{
+    stream_context.processors.clear();
+    if (!has_ddc(stream_context))
+    {
+        if (resample_l != 0 && stream_context.fft_size == 0)
+        {
+            for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
+            {
+                stream_context.processors.emplace_back(new Resampler(resample_l, resample_m));
+            }
+            SoapySDR::logf(SOAPY_SDR_INFO, "Afedri stream_id=%d resampler: %d/%d, output rate=%.1f, filter %s", stream_context.stream_id,
+                           (int)resample_l, (int)resample_m, sample_rate * (double)resample_l / (double)resample_m, dot2_impl_name());
+        }
+        return true;
+    }
+
+    if (sample_rate <= 0.0 || std::abs(stream_context.ddc_offset) >= sample_rate / 2)
+    {
+        SoapySDR::logf(SOAPY_SDR_ERROR, "Afedri stream_id=%d: ddc_offset=%.0f Hz is out of band of sample rate %.0f",
+                       stream_context.stream_id, stream_context.ddc_offset, sample_rate);
+        return false;
+    }
+
+    for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
+    {
+        stream_context.processors.emplace_back(new Ddc(stream_context.ddc_offset / sample_rate, stream_context.ddc_decim));
+    }
+
+    SoapySDR::logf(SOAPY_SDR_INFO, "Afedri stream_id=%d DDC: offset=%.0f Hz, decimation=%d, output rate=%.1f, filter %s",
+                   stream_context.stream_id, stream_context.ddc_offset, (int)stream_context.ddc_decim,
+                   sample_rate / (double)stream_context.ddc_decim, Ddc::impl_name());
+    return true;
+}
+
+// Result of a wait which gave no data: timeout, or error if the RX side died and woke up the reader.
+static int no_data(UdpRxContext const &ctx)
+{
+    return ctx.is_alive() ? SOAPY_SDR_TIMEOUT : SOAPY_SDR_STREAM_ERROR;
+}
+
+// Read through DDC or resampler of every channel. Input is aligned across channels, so all of them produce the same number
+// of samples. `sample_rate` is the hardware rate.
+static int read_processed(StreamContext &stream_context, void *const *buffs, size_t max_input_elements, double sample_rate, int &flags,
+                          long long &timeNs)
+{
+    std::vector<std::uint64_t> &positions = stream_context.read_positions;
+    const size_t len = align_stream_items(stream_context.stream_items, max_input_elements, positions);
+    if (len == 0)
+    {
+        return SOAPY_SDR_TIMEOUT;
+    }
+
+    // receive time of the first output sample: time of the first input sample shifted by position of the output sample
+    // between input samples and by delay of the filter
+    const double offset_ns = stream_context.processors[0]->output_offset() * 1e9 / sample_rate;
+    std::int64_t time_ns = 0;
+    const bool has_time = stream_context.stream_items[0]->channel_ring->time_tags.get(positions[0], sample_rate, time_ns);
+
+    size_t num_out = 0;
+    for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
+    {
+        const short *src = stream_context.stream_items[idx]->buffer.dataAt(positions[idx]);
+        if (stream_context.format == SOAPY_SDR_CS16)
+        {
+            num_out = stream_context.processors[idx]->process(src, len, (short *)buffs[idx]);
+        }
+        else
+        {
+            num_out = stream_context.processors[idx]->process(src, len, (float *)buffs[idx]);
+        }
+    }
+
+    bool committed = true;
+    for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
+    {
+        committed = stream_context.stream_items[idx]->buffer.commit(positions[idx], len) && committed;
+    }
+    if (!committed)
+    {
+        // filters got overwritten data, start them over in the same state
+        for (auto &processor : stream_context.processors)
+        {
+            processor->reset();
+        }
+        take_overflow(stream_context); // reported now
+        return SOAPY_SDR_OVERFLOW;
+    }
+
+    if (num_out == 0)
+    {
+        return SOAPY_SDR_TIMEOUT; // input is kept in filters
+    }
+
+    if (has_time)
+    {
+        timeNs = time_ns + std::llround(offset_ns);
+        flags |= SOAPY_SDR_HAS_TIME;
+    }
+    return (int)num_out;
+}
+
+// Create spectrum of every channel of a spectrum stream.
+static void create_spectrum(StreamContext &stream_context)
+{
+    stream_context.spectrum.clear();
+    if (stream_context.fft_size == 0)
+    {
+        return;
+    }
+
+    for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
+    {
+        stream_context.spectrum.emplace_back(new Spectrum(stream_context.fft_size, stream_context.fft_avg, stream_context.fft_window));
+    }
+    stream_context.frame_pos = stream_context.fft_size; // no frame to give yet
+}
+
+// Read averaged power spectra of every channel. A frame is given by whole, or in parts if numElems is smaller than FFT size;
+// the last part has SOAPY_SDR_END_BURST flag. Input is aligned across channels, like I+Q reads of several channels.
+static int read_spectrum(StreamContext &stream_context, void *const *buffs, size_t numElems, std::chrono::microseconds timeout,
+                         double sample_rate, int &flags, long long &timeNs)
+{
+    const size_t fft_size = stream_context.fft_size;
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (stream_context.frame_pos == fft_size)
+    {
+        const auto time_left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+        if (time_left.count() <= 0)
+        {
+            return SOAPY_SDR_TIMEOUT;
+        }
+
+        // frame may take more than ring can queue, then it is collected in parts
+        Spectrum &first_spectrum = *stream_context.spectrum[0];
+        const size_t input_needed = first_spectrum.input_for_frame();
+        for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
+        {
+            if (!stream_context.stream_items[idx]->wait_for_data(time_left, idx == 0 ? input_needed : 1))
+            {
+                return SOAPY_SDR_TIMEOUT;
+            }
+        }
+
+        std::vector<std::uint64_t> &positions = stream_context.read_positions;
+        const size_t len = align_stream_items(stream_context.stream_items, input_needed, positions);
+        if (len == 0)
+        {
+            continue;
+        }
+
+        if (input_needed == 2 * stream_context.fft_avg * fft_size) // I+Q per sample
+        {
+            std::int64_t time_ns = 0;
+            stream_context.frame_has_time =
+                stream_context.stream_items[0]->channel_ring->time_tags.get(positions[0], sample_rate, time_ns);
+            stream_context.frame_time_ns = time_ns;
+        }
+
+        bool completed = false;
+        for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
+        {
+            completed = stream_context.spectrum[idx]->feed(stream_context.stream_items[idx]->buffer.dataAt(positions[idx]), len);
+        }
+
+        bool committed = true;
+        for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
+        {
+            committed = stream_context.stream_items[idx]->buffer.commit(positions[idx], len) && committed;
+        }
+        if (!committed)
+        {
+            for (auto &spectrum : stream_context.spectrum)
+            {
+                spectrum->reset();
+            }
+            take_overflow(stream_context); // reported now
+            return SOAPY_SDR_OVERFLOW;
+        }
+
+        if (completed)
+        {
+            stream_context.frame_pos = 0;
+        }
+    }
+
+    const size_t num_bins = std::min(numElems, fft_size - stream_context.frame_pos);
+    for (size_t idx = 0; idx < stream_context.spectrum.size(); idx++)
+    {
+        std::memcpy(buffs[idx], stream_context.spectrum[idx]->frame().data() + stream_context.frame_pos, num_bins * sizeof(float));
+    }
+
+    if (stream_context.frame_pos == 0 && stream_context.frame_has_time)
+    {
+        timeNs = stream_context.frame_time_ns;
+        flags |= SOAPY_SDR_HAS_TIME;
+    }
+    stream_context.frame_pos += num_bins;
+    if (stream_context.frame_pos == fft_size)
+    {
+        flags |= SOAPY_SDR_END_BURST;
+    }
+    return (int)num_bins;
+}
+
+static SpectrumWindow parse_fft_window(std::string const &s)
+{
+    if (s == "hann")
+    {
+        return SpectrumWindow::Hann;
+    }
+    else if (s == "blackman_harris")
+    {
+        return SpectrumWindow::BlackmanHarris;
+    }
+    else if (s == "rect")
+    {
+        return SpectrumWindow::Rectangular;
+    }
+
+    SoapySDR::log(SOAPY_SDR_ERROR, "Invalid FFT window");
+    throw std::runtime_error("setupStream invalid fft_window '" + s + "'. Possible values: hann, blackman_harris, rect");
+}
+
+// Default ring size for each channel of a stream, in elements (I or Q).
+constexpr size_t default_ring_len = 1024 * 1024;
+constexpr size_t max_ring_len = 64 * 1024 * 1024;
+
+static size_t calc_gcd(size_t a, size_t b)
+{
+    while (b != 0)
+    {
+        const size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Ring length in elements for the stream, multiple of `slot_len` and of ring mapping granularity (page or huge page size).
+// RX thread puts up to `batch_size` packets at once, so ring holds at least two batches.
+// With OverflowPolicy::Block the ring also holds `overflow_wait` of samples: the reader may stall that long without loss.
+static size_t calc_ring_len(StreamContext const &stream_context, size_t slot_len, UdpRxOptions const &options, double sample_rate)
+{
+    size_t len = default_ring_len;
+    if (stream_context.ring_samples != 0)
+    {
+        len = stream_context.ring_samples * 2; // I+Q
+    }
+    else if (stream_context.ring_ms > 0.0 && sample_rate > 0.0)
+    {
+        len = static_cast<size_t>(stream_context.ring_ms * sample_rate / 1000.0) * 2;
+    }
+    if (stream_context.overflow_policy == OverflowPolicy::Block && sample_rate > 0.0)
+    {
+        len += static_cast<size_t>(stream_context.overflow_wait.count() * sample_rate / 1e6) * 2;
+    }
+
+    len = std::min(std::max(len, std::max<size_t>(4, 2 * options.batch_size) * slot_len), max_ring_len);
+
+    const size_t granularity = CMirroredStorage::granularity(options.huge_pages);
+    const size_t unit = slot_len / calc_gcd(slot_len, granularity) * granularity;
+    return (len + unit - 1) / unit * unit;
+}
+
+// Streams which must keep their queued data can't read the channel ring, the RX thread never waits for its readers.
+static bool needs_own_ring(StreamContext const &stream_context)
+{
+    return stream_context.own_ring || stream_context.direct_access || stream_context.overflow_policy != OverflowPolicy::DropOldest;
+}
+
+static void allocate_ring(ChannelRing &channel_ring, size_t len, size_t slot_len, UdpRxOptions const &options, size_t channel)
+{
+    RingMemoryOptions memory_options;
+    memory_options.huge_pages = options.huge_pages;
+    memory_options.lock = options.lock_memory;
+    channel_ring.ring.allocate(len, memory_options);
+    const bool tags_locked = channel_ring.time_tags.allocate(len, slot_len, memory_options.lock);
+
+    CMirroredStorage const &storage = channel_ring.ring.storage();
+    if (memory_options.huge_pages && !storage.hugePages())
+    {
+        SoapySDR::logf(SOAPY_SDR_WARNING, "Afedri ring of channel %d: no huge pages (vm.nr_hugepages), normal pages are used",
+                       (int)channel);
+    }
+    if (memory_options.lock && (!storage.locked() || !tags_locked))
+    {
+        SoapySDR::logf(SOAPY_SDR_WARNING, "Afedri ring of channel %d can't be locked in memory, check RLIMIT_MEMLOCK (ulimit -l)",
+                       (int)channel);
+    }
+}
+
+// Allocate ring of every channel of the stream if no other stream reads it, prepare readers. Stream must be inactive.
+// Channel ring is shared by all streams of the channel, so its size is the largest one requested by them.
+// A stream which needs a ring of its own gets it in the size it requested.
+void AfedriDevice::allocate_stream_buffers(StreamContext &stream_context)
+{
+    auto &udp_rx_ctx = _udp_rx_thread_defer->get_ctx();
+    const size_t slot_len = udp_rx_ctx->elements_per_packet();
+    const bool own = needs_own_ring(stream_context);
+
+    for (size_t idx = 0; idx < stream_context.channels.size(); idx++)
+    {
+        const size_t channel = stream_context.channels[idx];
+        StreamItem *stream_item = stream_context.stream_items[idx];
+
+        if (own)
+        {
+            const size_t len = calc_ring_len(stream_context, slot_len, udp_rx_ctx->options, _saved_sample_rate);
+            if (!stream_item->own_ring)
+            {
+                stream_item->own_ring.reset(new ChannelRing());
+            }
+            if (stream_item->own_ring->ring.size() != len)
+            {
+                allocate_ring(*stream_item->own_ring, len, slot_len, udp_rx_ctx->options, channel);
+            }
+            stream_item->use_ring(*stream_item->own_ring);
+        }
+        else
+        {
+            ChannelRing &channel_ring = udp_rx_ctx->rings[channel];
+
+            bool in_use = false;
+            {
+                std::unique_lock<std::mutex> lock(udp_rx_ctx->mtx_channel);
+                for (auto const &item : udp_rx_ctx->channels[channel])
+                {
+                    in_use = in_use || (item.active.load() && item.channel_ring == &channel_ring);
+                }
+            }
+
+            size_t len = 0;
+            {
+                std::unique_lock<std::mutex> lock(_streams_protect_mtx);
+                for (auto const &item : _configured_streams)
+                {
+                    auto const &chs = item.second.channels;
+                    if (!needs_own_ring(item.second) && std::find(chs.begin(), chs.end(), channel) != chs.end())
+                    {
+                        len = std::max(len, calc_ring_len(item.second, slot_len, udp_rx_ctx->options, _saved_sample_rate));
+                    }
+                }
+            }
+
+            if (!in_use && channel_ring.ring.size() != len)
+            {
+                allocate_ring(channel_ring, len, slot_len, udp_rx_ctx->options, channel);
+            }
+            else if (in_use && channel_ring.ring.size() < len)
+            {
+                SoapySDR::logf(SOAPY_SDR_WARNING, "Afedri ring of channel %d is in use by other stream, its size %d is kept", (int)channel,
+                               (int)channel_ring.ring.size());
+            }
+            stream_item->use_ring(channel_ring);
+        }
+
+        stream_item->reset();
+        stream_item->buffer.setOverflowPolicy(stream_context.overflow_policy);
+        if (stream_context.direct_access)
+        {
+            stream_item->buffer.keep_unread_data(); // data must not be overwritten while application holds the pointer
+        }
+
+        const size_t ring_len = stream_item->buffer.size();
+        SoapySDR::logf(SOAPY_SDR_INFO, "Afedri stream_id=%d channel %d: %s ring of %d samples (%.0f ms)", stream_context.stream_id,
+                       (int)channel, own ? "own" : "shared", (int)(ring_len / 2),
+                       _saved_sample_rate > 0.0 ? ring_len / 2 * 1000.0 / _saved_sample_rate : 0.0);
+    }
+}
+
+// Direct access hands out ring memory, which must not be overwritten while the application holds it,
+// so the stream moves to rings of its own. Data queued in the channel ring is dropped.
+void AfedriDevice::enable_direct_access(StreamContext &stream_context)
+{
+    if (stream_context.direct_access)
+    {
+        return;
+    }
+    stream_context.direct_access = true;
+
+    for (StreamItem *stream_item : stream_context.stream_items)
+    {
+        stream_item->set_active(false); // RX thread doesn't touch the stream any more
+    }
+    allocate_stream_buffers(stream_context);
+    for (StreamItem *stream_item : stream_context.stream_items)
+    {
+        stream_item->set_active(stream_context.active);
+    }
+}
+
+static OverflowPolicy parse_overflow_policy(std::string const &s)
+{
+    if (s == "drop_oldest")
+    {
+        return OverflowPolicy::DropOldest;
+    }
+    else if (s == "drop_newest")
+    {
+        return OverflowPolicy::DropNewest;
+    }
+    else if (s == "block")
+    {
+        return OverflowPolicy::Block;
+    }
+
+    SoapySDR::log(SOAPY_SDR_ERROR, "Invalid overflow policy");
+    throw std::runtime_error("setupStream invalid overflow '" + s + "'. Possible values: drop_oldest, drop_newest, block");
+}
+
 SoapySDR::Stream *AfedriDevice::setupStream(const int direction, const std::string &format, const std::vector<size_t> &channels,
-                                            const SoapySDR::Kwargs & /*args*/)
+                                            const SoapySDR::Kwargs &args)
 {
     SoapySDR::logf(SOAPY_SDR_INFO, "Afedri in setupStream. Num_channels=%d, format=%s", channels.size(), format.c_str());
 
@@ -76,24 +516,130 @@ SoapySDR::Stream *AfedriDevice::setupStream(const int direction, const std::stri
     {
         selected_format = format;
     }
+    else if (format == SOAPY_SDR_F32)
+    {
+        selected_format = format; // spectrum stream
+    }
     else
     {
         SoapySDR::log(SOAPY_SDR_ERROR, "Invalid stream format");
         throw std::runtime_error("setupStream invalid format '" + format +
-                                 "' -- Only CS16, and CF32 are supported by AfedriDevice module.");
+                                 "' -- Only CS16, CF32 (I+Q) and F32 (spectrum) are supported by AfedriDevice module.");
+    }
+
+    size_t ring_samples = 0;
+    double ring_ms = 0.0;
+    double overflow_wait_ms = 100.0;
+    size_t min_elems = 0;
+    double wakeup_ms = 0.0;
+    double ddc_offset = 0.0;
+    size_t ddc_decim = 1;
+    size_t fft_size = 1024;
+    size_t fft_avg = 10;
+    bool own_ring = false;
+    try
+    {
+        if (args.count("fft_size"))
+        {
+            fft_size = std::stoul(args.at("fft_size"));
+        }
+        if (args.count("fft_avg"))
+        {
+            fft_avg = std::stoul(args.at("fft_avg"));
+        }
+        if (args.count("ddc_offset"))
+        {
+            ddc_offset = std::stod(args.at("ddc_offset"));
+        }
+        if (args.count("ddc_decim"))
+        {
+            ddc_decim = std::stoul(args.at("ddc_decim"));
+        }
+        if (args.count("min_elems"))
+        {
+            min_elems = std::stoul(args.at("min_elems"));
+        }
+        if (args.count("wakeup_ms"))
+        {
+            wakeup_ms = std::stod(args.at("wakeup_ms"));
+        }
+        if (args.count("overflow_wait_ms"))
+        {
+            overflow_wait_ms = std::stod(args.at("overflow_wait_ms"));
+        }
+        if (args.count("ring_samples"))
+        {
+            ring_samples = std::stoul(args.at("ring_samples"));
+        }
+        if (args.count("ring_ms"))
+        {
+            ring_ms = std::stod(args.at("ring_ms"));
+        }
+        if (args.count("own_ring"))
+        {
+            own_ring = args.at("own_ring") == "1" || args.at("own_ring") == "true";
+        }
+    }
+    catch (std::exception &)
+    {
+        SoapySDR::log(SOAPY_SDR_ERROR, "Invalid stream argument");
+        throw std::runtime_error("setupStream invalid ring_samples, ring_ms, own_ring, overflow_wait_ms, min_elems, wakeup_ms, "
+                                 "ddc_offset, ddc_decim, fft_size or fft_avg value");
     }
 
+    if (ddc_decim < 1 || ddc_decim > 1024)
+    {
+        SoapySDR::log(SOAPY_SDR_ERROR, "Invalid DDC decimation");
+        throw std::runtime_error("setupStream invalid ddc_decim. Possible values: 1..1024");
+    }
+
+    const bool is_spectrum = selected_format == SOAPY_SDR_F32;
+    if (is_spectrum && (fft_size < 16 || fft_size > 65536 || (fft_size & (fft_size - 1)) != 0 || fft_avg < 1 || fft_avg > 100000))
+    {
+        SoapySDR::log(SOAPY_SDR_ERROR, "Invalid FFT size or averaging");
+        throw std::runtime_error("setupStream invalid fft_size (power of 2, 16..65536) or fft_avg (1..100000)");
+    }
+    if (is_spectrum && (ddc_decim != 1 || ddc_offset != 0.0))
+    {
+        SoapySDR::log(SOAPY_SDR_ERROR, "DDC is not supported by spectrum stream");
+        throw std::runtime_error("setupStream: ddc_offset and ddc_decim are not supported with F32 (spectrum) format");
+    }
+    const SpectrumWindow fft_window = args.count("fft_window") ? parse_fft_window(args.at("fft_window")) : SpectrumWindow::Hann;
+
+    const OverflowPolicy overflow_policy = args.count("overflow") ? parse_overflow_policy(args.at("overflow")) : OverflowPolicy::DropOldest;
+
     int just_obtained_stream_id;
+    StreamContext *stream_context;
 
     {
         std::unique_lock<std::mutex> lock(_streams_protect_mtx);
         just_obtained_stream_id = _stream_sequence_provider++;
-        _configured_streams[just_obtained_stream_id] = StreamContext(wrk_channels, selected_format, false);
+        auto res = _configured_streams.emplace(std::piecewise_construct, std::forward_as_tuple(just_obtained_stream_id),
+                                               std::forward_as_tuple(just_obtained_stream_id, wrk_channels, selected_format));
+        stream_context = &res.first->second;
+        stream_context->ring_samples = ring_samples;
+        stream_context->ring_ms = ring_ms;
+        stream_context->overflow_policy = overflow_policy;
+        stream_context->own_ring = own_ring;
+        stream_context->overflow_wait = std::chrono::microseconds(static_cast<long long>(overflow_wait_ms * 1000.0));
+        stream_context->min_elems = min_elems;
+        if (wakeup_ms > 0.0)
+        {
+            stream_context->wakeup_latency = std::chrono::microseconds(static_cast<long long>(wakeup_ms * 1000.0));
+        }
+        stream_context->ddc_offset = ddc_offset;
+        stream_context->ddc_decim = ddc_decim;
+        if (is_spectrum)
+        {
+            stream_context->fft_size = fft_size;
+            stream_context->fft_avg = fft_avg;
+            stream_context->fft_window = fft_window;
+        }
     }
 
     // Add StreamItem to udp rx context
     {
-        auto udp_rx_ctx = _udp_rx_thread_defer->get_ctx();
+        auto &udp_rx_ctx = _udp_rx_thread_defer->get_ctx();
         std::unique_lock<std::mutex> lock(udp_rx_ctx->mtx_channel);
         for (size_t channel_id : wrk_channels)
         {
@@ -103,11 +649,16 @@ SoapySDR::Stream *AfedriDevice::setupStream(const int direction, const std::stri
             auto stream_it = my_find_if(stream.begin(), stream.end(), pred);
             if (stream_it != stream.end())
             {
+                stream_it->use_ring(udp_rx_ctx->rings[channel_id]); // until activation
+                stream_it->reset();                                 // drop data of previous stream
                 stream_it->unique_stream_id = just_obtained_stream_id;
+                stream_context->stream_items.push_back(&*stream_it);
             }
             else
             {
-                stream.emplace_back(just_obtained_stream_id);
+                // deque never moves existing elements on emplace_back
+                stream.emplace_back(just_obtained_stream_id, udp_rx_ctx->rings[channel_id]);
+                stream_context->stream_items.push_back(&stream.back());
             }
         }
     }
@@ -127,31 +678,28 @@ SoapySDR::Stream *AfedriDevice::setupStream(const int direction, const std::stri
         SoapySDR::log(SOAPY_SDR_INFO, s.c_str());
     }
 
-    return (SoapySDR::Stream *)(new int(just_obtained_stream_id));
+    return reinterpret_cast<SoapySDR::Stream *>(stream_context);
 }
 
 void AfedriDevice::closeStream(SoapySDR::Stream *stream)
 {
-    int stream_id = *reinterpret_cast<int *>(stream);
+    StreamContext &stream_context = get_stream_context(stream);
+    const int stream_id = stream_context.stream_id;
     SoapySDR::logf(SOAPY_SDR_DEBUG, "Afedri in closeStream stream_id=%d", stream_id);
 
     this->deactivateStream(stream, 0, 0);
 
     // Remove StreamItem from udp rx context channels (make it inactive)
     {
-        auto udp_rx_ctx = _udp_rx_thread_defer->get_ctx();
+        auto &udp_rx_ctx = _udp_rx_thread_defer->get_ctx();
         std::unique_lock<std::mutex> lock(udp_rx_ctx->mtx_channel);
 
-        // scan through all channels and make strem_items slot inactive
-        for (auto &channel : udp_rx_ctx->channels)
+        for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
         {
-            for (auto &stream_item : channel)
-            {
-                if (stream_item.unique_stream_id == stream_id)
-                {
-                    stream_item.unique_stream_id = 0;
-                }
-            }
+            StreamItem *stream_item = stream_context.stream_items[idx];
+            stream_item->unique_stream_id = 0;
+            stream_item->use_ring(udp_rx_ctx->rings[stream_context.channels[idx]]);
+            stream_item->own_ring.reset(); // inactive, RX thread doesn't touch it
         }
     }
 
@@ -159,8 +707,6 @@ void AfedriDevice::closeStream(SoapySDR::Stream *stream)
         std::unique_lock<std::mutex> lock(_streams_protect_mtx);
         _configured_streams.erase(stream_id); // destroy stream context by id
     }
-
-    delete reinterpret_cast<int *>(stream);
 }
 
 size_t AfedriDevice::getStreamMTU(SoapySDR::Stream * /*stream*/) const
@@ -170,18 +716,35 @@ size_t AfedriDevice::getStreamMTU(SoapySDR::Stream * /*stream*/) const
 
 int AfedriDevice::activateStream(SoapySDR::Stream *stream, const int flags, const long long /*timeNs*/, const size_t /*numElems*/)
 {
-    const int stream_id = *reinterpret_cast<int *>(stream);
-    SoapySDR::logf(SOAPY_SDR_DEBUG, "Afedri in activateStream stream_id=%d flags=%d ", stream_id, flags);
+    StreamContext &stream_context = get_stream_context(stream);
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "Afedri in activateStream stream_id=%d flags=%d ", stream_context.stream_id, flags);
 
     if (flags != 0)
     {
         return SOAPY_SDR_NOT_SUPPORTED;
     }
 
-    StreamContext &stream_context = get_stream_context_by_id(stream_id);
+    if (!stream_context.active)
+    {
+        if (!create_processors(stream_context, _saved_sample_rate, _resample_l, _resample_m))
+        {
+            return SOAPY_SDR_STREAM_ERROR;
+        }
+        create_spectrum(stream_context);
+
+        // memory is allocated only for streams which are really used
+        allocate_stream_buffers(stream_context);
+        for (StreamItem *stream_item : stream_context.stream_items)
+        {
+            stream_item->set_active(true);
+        }
+    }
     stream_context.active = true;
 
-    _afedri_control.start_capture(); // Activate stream. Multiple calls - not a problem.
+    if (_afedri_control)
+    {
+        _afedri_control->start_capture(); // Activate stream. Multiple calls - not a problem.
+    }
     SoapySDR::logf(SOAPY_SDR_DEBUG, "Afedri start capture");
 
     _udp_rx_thread_defer->get_ctx()->rx_active = true; // flag to allow process UDP RX data
@@ -191,16 +754,26 @@ int AfedriDevice::activateStream(SoapySDR::Stream *stream, const int flags, cons
 
 int AfedriDevice::deactivateStream(SoapySDR::Stream *stream, const int flags, const long long /*timeNs*/)
 {
-    const int stream_id = *reinterpret_cast<int *>(stream);
-    SoapySDR::logf(SOAPY_SDR_DEBUG, "Afedri in deactivateStream stream_id=%d, flags=%d", stream_id, flags);
+    StreamContext &stream_context = get_stream_context(stream);
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "Afedri in deactivateStream stream_id=%d, flags=%d", stream_context.stream_id, flags);
 
     if (flags != 0)
     {
         return SOAPY_SDR_NOT_SUPPORTED;
     }
 
-    StreamContext &stream_context = get_stream_context_by_id(stream_id);
     stream_context.active = false;
+    for (StreamItem *stream_item : stream_context.stream_items)
+    {
+        stream_item->set_active(false);
+    }
+
+    if (!stream_context.stream_items.empty())
+    {
+        const size_t samples_dropped = stream_context.stream_items[0]->buffer.elementsDropped() / 2; // I+Q
+        SoapySDR::logf(SOAPY_SDR_INFO, "Afedri stream_id=%d samples discarded on overflow=%d", stream_context.stream_id,
+                       (int)samples_dropped);
+    }
 
     // Calculate number of active streams.
     int num_active_streams = 0;
@@ -216,20 +789,27 @@ int AfedriDevice::deactivateStream(SoapySDR::Stream *stream, const int flags, co
 
     if (num_active_streams == 0)
     {
-        _afedri_control.stop_capture();
+        if (_afedri_control)
+        {
+            _afedri_control->stop_capture();
+        }
         SoapySDR::logf(SOAPY_SDR_INFO, "Afedri stop capture");
 
+        auto &udp_rx_ctx = _udp_rx_thread_defer->get_ctx();
+        SoapySDR::logf(SOAPY_SDR_INFO, "Afedri UDP packets lost in network=%d, dropped by kernel=%d", (int)udp_rx_ctx->packets_lost.load(),
+                       (int)udp_rx_ctx->kernel_drops.load());
+
         _udp_rx_thread_defer->get_ctx()->rx_active = false; // flag to stop process UDP RX data
     }
 
     return 0;
 }
 
-int AfedriDevice::readStream(SoapySDR::Stream *stream, void *const *buffs, const size_t numElems, int & /*flags*/, long long & /*timeNs*/,
+int AfedriDevice::readStream(SoapySDR::Stream *stream, void *const *buffs, const size_t numElems, int &flags, long long &timeNs,
                              const long timeoutUs)
 {
-    const int stream_id = *reinterpret_cast<int *>(stream);
-    StreamContext const &stream_context = get_stream_context_by_id(stream_id);
+    StreamContext &stream_context = get_stream_context(stream);
+    flags = 0;
 
     // SoapySDR::logf(SOAPY_SDR_DEBUG, "in readStream flags=%d numElems=%d, timeoutUs=%d ", flags, numElems, timeoutUs);
 
@@ -240,92 +820,294 @@ int AfedriDevice::readStream(SoapySDR::Stream *stream, void *const *buffs, const
         throw std::runtime_error("UDP thread not present");
     }
 
-    auto udp_rx_context = _udp_rx_thread_defer->get_ctx();
-    if (!udp_rx_context->is_alive())
+    if (!_udp_rx_thread_defer->get_ctx()->is_alive())
     {
-        // should never happen
-        SoapySDR::logf(SOAPY_SDR_ERROR, "UDP thread is not alive");
-        throw std::runtime_error("UDP thread is not alive");
+        return SOAPY_SDR_STREAM_ERROR; // RX thread or reactor gave up on the socket, no data will come
     }
 
-    if (stream_context.channels.empty())
+    if (stream_context.stream_items.empty())
     {
         // Should never happen, but if happens - then nothing to do.
         return 0;
     }
 
+    if (take_overflow(stream_context))
+    {
+        return SOAPY_SDR_OVERFLOW; // data is still in buffers, next call reads it
+    }
+
+    if (!stream_context.spectrum.empty())
+    {
+        return read_spectrum(stream_context, buffs, numElems, std::chrono::microseconds(timeoutUs), _saved_sample_rate, flags, timeNs);
+    }
+
     // Each soapySDR sample(CS16 or CF32) takes 2 our elements (I(short) + Q(short)).
     const size_t data_format_scale_factor = 2;
 
     const size_t max_elements_in_shorts = numElems * data_format_scale_factor;
-    size_t elements_to_read_from_first_channel = 0;
 
-    std::vector<std::vector<short>> read_data_for_channels(4); // 4 channels max
+    // With DDC or resampler numElems and min_elems are output samples, wake up on input of them.
+    const bool use_processor = !stream_context.processors.empty();
+    const size_t max_input_elements =
+        use_processor ? stream_context.processors[0]->input_for(numElems) * data_format_scale_factor : max_elements_in_shorts;
 
-    auto stream_find_pred = [stream_id](const StreamItem &stream_item) -> bool { return stream_item.unique_stream_id == stream_id; };
+    // Wake up when the whole request (or min_elems) is buffered, not on every packet. Partial data is returned after wakeup latency.
+    size_t wake_elements = max_input_elements;
+    if (stream_context.min_elems != 0)
+    {
+        const size_t min_input =
+            use_processor ? stream_context.processors[0]->input_for(stream_context.min_elems) : stream_context.min_elems;
+        wake_elements = std::min(min_input * data_format_scale_factor, max_input_elements);
+    }
+    auto us = std::chrono::microseconds(timeoutUs);
+    if (!stream_context.stream_items[0]->wait_for_data(us, wake_elements, stream_context.wakeup_latency))
+    {
+        return no_data(*_udp_rx_thread_defer->get_ctx());
+    }
 
+    // Channels are published by RX thread one after another, wait until all of them have data.
+    for (size_t idx = 1; idx < stream_context.stream_items.size(); idx++)
     {
-        auto &stream = udp_rx_context->channels[stream_context.channels[0]];
-        auto stream_it = my_find_if(stream.begin(), stream.end(), stream_find_pred);
+        if (!stream_context.stream_items[idx]->wait_for_data(us))
+        {
+            return no_data(*_udp_rx_thread_defer->get_ctx());
+        }
+    }
 
-        std::unique_lock<std::mutex> lock(stream_it->mtx);
+    if (use_processor)
+    {
+        return read_processed(stream_context, buffs, max_input_elements, _saved_sample_rate, flags, timeNs);
+    }
+
+    // CS16 is copied to application buffers, other formats are converted straight out of the ring.
+    const bool is_native_format = stream_context.format == SOAPY_SDR_CS16;
 
-        auto us = std::chrono::microseconds(timeoutUs);
-        auto pred = [&stream_it]() { return stream_it->buffer.elementsAvailable() > 0; };
-        bool is_signalled = stream_it->signal.wait_for(lock, us, pred);
-        if (is_signalled)
+    std::uint64_t read_pos = 0;
+    size_t elements_did_read = 0;
+    if (stream_context.stream_items.size() == 1)
+    {
+        StreamItem &stream_item = *stream_context.stream_items[0];
+        if (is_native_format)
+        {
+            elements_did_read = stream_item.buffer.read((short *)buffs[0], max_elements_in_shorts, &read_pos);
+        }
+        else
+        {
+            // CF32: convert short -> float. SIMD implementation is selected by CPU features.
+            float *dst = (float *)buffs[0];
+            auto convert = [dst](const short *src, size_t n) { convert_s16_to_f32(src, dst, n); };
+            elements_did_read = stream_item.buffer.readInPlace(max_elements_in_shorts, convert, &read_pos);
+        }
+    }
+    else
+    {
+        // Several channels: read the same samples of the same packets from every channel, so channels are always aligned.
+        std::vector<std::uint64_t> &positions = stream_context.read_positions;
+        elements_did_read = align_stream_items(stream_context.stream_items, max_elements_in_shorts, positions);
+        for (size_t idx = 0; idx < stream_context.stream_items.size() && elements_did_read != 0; idx++)
         {
-            // Number of elements in first channel limited by input parameter numElems
-            elements_to_read_from_first_channel = std::min(max_elements_in_shorts, stream_it->buffer.elementsAvailable());
+            const short *src = stream_context.stream_items[idx]->buffer.dataAt(positions[idx]);
+            if (is_native_format)
+            {
+                std::memcpy(buffs[idx], src, elements_did_read * sizeof(short));
+            }
+            else
+            {
+                convert_s16_to_f32(src, (float *)buffs[idx], elements_did_read);
+            }
+        }
 
-            read_data_for_channels[0].resize(elements_to_read_from_first_channel);
-            stream_it->buffer.peek(read_data_for_channels[0].data(), elements_to_read_from_first_channel);
-            stream_it->buffer.consume(elements_to_read_from_first_channel);
+        // Commit all channels. If the producer has overwritten data of any channel meanwhile, the read is lost as a whole.
+        bool committed = true;
+        for (size_t idx = 0; idx < stream_context.stream_items.size() && elements_did_read != 0; idx++)
+        {
+            committed = stream_context.stream_items[idx]->buffer.commit(positions[idx], elements_did_read) && committed;
         }
+        if (!committed)
+        {
+            take_overflow(stream_context); // reported now
+            return SOAPY_SDR_OVERFLOW;
+        }
+        read_pos = positions[0];
     }
 
-    if (elements_to_read_from_first_channel == 0)
+    if (elements_did_read == 0)
     {
         return SOAPY_SDR_TIMEOUT;
     }
 
-    // number of data available to read from each channel must be the equal, but for some reason we need a protection logic:
-    // read data from other channels, but no more than from the first channel.
-    for (size_t idx = 1; idx < stream_context.channels.size(); idx++)
+    // receive time of the first sample
+    std::int64_t time_ns;
+    if (stream_context.stream_items[0]->channel_ring->time_tags.get(read_pos, _saved_sample_rate, time_ns))
+    {
+        timeNs = time_ns;
+        flags |= SOAPY_SDR_HAS_TIME;
+    }
+
+    return (int)elements_did_read / (int)data_format_scale_factor;
+}
+
+/*******************************************************************
+ * Direct buffer access API
+ ******************************************************************/
+
+// Every UDP packet is put to stream buffers as one slot of `elements_per_packet` elements.
+// Buffer size is a multiple of slot size, so each slot is a contiguous memory, and we give a pointer to it.
+// Only CS16 (native) format is supported.
+
+size_t AfedriDevice::getNumDirectAccessBuffers(SoapySDR::Stream *stream)
+{
+    StreamContext &stream_context = get_stream_context(stream);
+    if (!direct_access_supported(stream_context, _resample_l != 0))
+    {
+        return 0;
+    }
+
+    if (!stream_context.direct_access)
+    {
+        enable_direct_access(stream_context); // addresses are needed before activation
+    }
+
+    const size_t slot_len = _udp_rx_thread_defer->get_ctx()->elements_per_packet();
+    return stream_context.stream_items[0]->buffer.size() / slot_len;
+}
+
+int AfedriDevice::getDirectAccessBufferAddrs(SoapySDR::Stream *stream, const size_t handle, void **buffs)
+{
+    StreamContext &stream_context = get_stream_context(stream);
+    if (!direct_access_supported(stream_context, _resample_l != 0))
+    {
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+
+    if (!stream_context.direct_access)
+    {
+        enable_direct_access(stream_context); // addresses are needed before activation
+    }
+
+    const size_t slot_len = _udp_rx_thread_defer->get_ctx()->elements_per_packet();
+    for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
+    {
+        StreamItem &stream_item = *stream_context.stream_items[idx];
+        buffs[idx] = const_cast<short *>(stream_item.buffer.data() + handle * slot_len);
+    }
+
+    return 0;
+}
+
+// True if the next slot of every channel holds the same device packet. Unread data of direct access rings is kept by
+// the producer, so the answer stays valid until the slots are acquired.
+static bool next_slots_aligned(std::vector<StreamItem *> const &items)
+{
+    std::uint64_t first_packet = 0;
+    for (size_t idx = 0; idx < items.size() && items.size() > 1; idx++)
     {
-        auto &stream = udp_rx_context->channels[stream_context.channels[idx]];
-        auto stream_it = my_find_if(stream.begin(), stream.end(), stream_find_pred);
+        std::uint64_t packet_number;
+        if (!items[idx]->channel_ring->time_tags.get_packet_number(items[idx]->buffer.readPosition(), packet_number))
+        {
+            return false;
+        }
+        if (idx == 0)
+        {
+            first_packet = packet_number;
+        }
+        else if (packet_number != first_packet)
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
-        std::unique_lock<std::mutex> lock(stream_it->mtx); // lock for buffer access
-        const size_t elements_to_read = std::min(elements_to_read_from_first_channel, stream_it->buffer.elementsAvailable());
-        read_data_for_channels[idx].resize(elements_to_read);
-        stream_it->buffer.peek(read_data_for_channels[idx].data(), elements_to_read);
-        stream_it->buffer.consume(elements_to_read);
+int AfedriDevice::acquireReadBuffer(SoapySDR::Stream *stream, size_t &handle, const void **buffs, int &flags, long long &timeNs,
+                                    const long timeoutUs)
+{
+    StreamContext &stream_context = get_stream_context(stream);
+    if (!direct_access_supported(stream_context, _resample_l != 0))
+    {
+        return SOAPY_SDR_NOT_SUPPORTED;
     }
 
-    if (stream_context.format == SOAPY_SDR_CS16)
+    flags = 0;
+    timeNs = 0;
+
+    if (!stream_context.direct_access)
     {
-        // for CS16 format we use simple byte-to-byte copy.
-        for (size_t idx = 0; idx < stream_context.channels.size(); idx++)
+        enable_direct_access(stream_context);
+    }
+
+    if (take_overflow(stream_context))
+    {
+        return SOAPY_SDR_OVERFLOW;
+    }
+
+    const size_t slot_len = _udp_rx_thread_defer->get_ctx()->elements_per_packet();
+    auto us = std::chrono::microseconds(timeoutUs);
+
+    // wait for a packet in every channel of the stream
+    for (StreamItem *stream_item_ptr : stream_context.stream_items)
+    {
+        StreamItem &stream_item = *stream_item_ptr;
+        if (!stream_item.wait_for_data(us))
+        {
+            return no_data(*_udp_rx_thread_defer->get_ctx());
+        }
+    }
+
+    // Rings of channels drop packets on their own, so slots given together must hold the same packet. Channels are synced
+    // again when the application holds no buffers, otherwise the loss is reported until it releases them.
+    if (!next_slots_aligned(stream_context.stream_items))
+    {
+        for (StreamItem *stream_item_ptr : stream_context.stream_items)
+        {
+            if (stream_item_ptr->buffer.elementsAcquired() != 0)
+            {
+                return SOAPY_SDR_OVERFLOW;
+            }
+        }
+        if (align_stream_items(stream_context.stream_items, slot_len, stream_context.read_positions) == 0)
         {
-            void *dst_buff = buffs[idx];
-            std::memcpy(dst_buff, read_data_for_channels[idx].data(), read_data_for_channels[idx].size() * sizeof(short));
+            return SOAPY_SDR_TIMEOUT; // a channel has no data of the packet yet
         }
     }
-    else if (stream_context.format == SOAPY_SDR_CF32)
+
+    for (size_t idx = 0; idx < stream_context.stream_items.size(); idx++)
     {
-        const float F_INT16MAX = 32768.0f;
-        // Convert short -> float in loop for each channel.
-        for (size_t idx = 0; idx < stream_context.channels.size(); idx++)
+        StreamItem &stream_item = *stream_context.stream_items[idx];
+        std::uint64_t read_pos = 0;
+        const short *ptr = stream_item.buffer.acquire(slot_len, &read_pos);
+        if (ptr == nullptr)
+        {
+            // should never happen, data is always put by whole slots
+            SoapySDR::logf(SOAPY_SDR_ERROR, "Afedri acquireReadBuffer: slot is not ready. stream_id=%d", stream_context.stream_id);
+            throw std::runtime_error("acquireReadBuffer slot is not ready");
+        }
+
+        buffs[idx] = ptr;
+        if (idx == 0)
         {
-            float *dst_buff = (float *)buffs[idx];
-            for (size_t j = 0; j < read_data_for_channels[idx].size(); j++)
+            handle = static_cast<size_t>(ptr - stream_item.buffer.data()) / slot_len;
+
+            std::int64_t time_ns;
+            if (stream_item.channel_ring->time_tags.get(read_pos, _saved_sample_rate, time_ns))
             {
-                *dst_buff = (float)read_data_for_channels[idx][j] / F_INT16MAX;
-                dst_buff++;
+                timeNs = time_ns;
+                flags |= SOAPY_SDR_HAS_TIME;
             }
         }
     }
 
-    return (int)elements_to_read_from_first_channel / (int)data_format_scale_factor;
+    return static_cast<int>(slot_len / 2); // I+Q per sample
+}
+
+void AfedriDevice::releaseReadBuffer(SoapySDR::Stream *stream, const size_t /*handle*/)
+{
+    // Buffers are released in the same order they were acquired, so handle is not needed.
+    StreamContext const &stream_context = get_stream_context(stream);
+
+    const size_t slot_len = _udp_rx_thread_defer->get_ctx()->elements_per_packet();
+    for (StreamItem *stream_item : stream_context.stream_items)
+    {
+        stream_item->buffer.release(slot_len);
+    }
 }
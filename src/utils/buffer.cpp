@@ -6,107 +6,479 @@
 
 #include "buffer.hpp"
 
+#include "portable_utils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+
 #include <memory.h>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//---------------------------------------------------------------------------------------------------
+CMirroredStorage::~CMirroredStorage()
+{
+    release();
+}
+
+//---------------------------------------------------------------------------------------------------
+size_t CMirroredStorage::granularity(bool huge_pages)
+{
+#if defined(__linux__)
+    static const size_t page_elements = static_cast<size_t>(sysconf(_SC_PAGESIZE)) / sizeof(short);
+    static const size_t huge_page_elements = []() {
+        size_t kb = 2048; // x86 default
+        std::ifstream meminfo("/proc/meminfo");
+        std::string key;
+        while (meminfo >> key)
+        {
+            if (key == "Hugepagesize:")
+            {
+                meminfo >> kb;
+                break;
+            }
+        }
+        return kb * 1024 / sizeof(short);
+    }();
+    return huge_pages ? huge_page_elements : page_elements;
+#else
+    (void)huge_pages;
+    return 1;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------
+void CMirroredStorage::release()
+{
+#if defined(__linux__)
+    if (m_mapped)
+    {
+        munmap(m_data, 2 * m_size * sizeof(short));
+    }
+#endif
+    std::vector<short>().swap(m_copy);
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    m_huge_pages = false;
+    m_locked = false;
+}
+
 //---------------------------------------------------------------------------------------------------
-CBuffer::CBuffer(size_t bufferSize)
+bool CMirroredStorage::map(size_t size, bool huge_pages)
 {
-    m_buffer.resize(bufferSize);
-    m_head = 0;
-    m_tail = 0;
+#if defined(__linux__)
+    if (size % granularity(huge_pages) != 0)
+    {
+        return false;
+    }
+
+    const size_t bytes = size * sizeof(short);
+    int fd = memfd_create("afedri-ring", MFD_CLOEXEC | (huge_pages ? MFD_HUGETLB : 0));
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool res = false;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) == 0)
+    {
+        // Reserve address range for both copies, then map the same pages into its halves.
+        // MAP_POPULATE prefaults the ring now, at stream activation, not in RX thread. Huge pages are reserved here or mmap fails.
+        void *addr = mmap(nullptr, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr != MAP_FAILED)
+        {
+            char *base = static_cast<char *>(addr);
+            const int flags = MAP_SHARED | MAP_FIXED | MAP_POPULATE;
+            if (mmap(base, bytes, PROT_READ | PROT_WRITE, flags, fd, 0) != MAP_FAILED &&
+                mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, flags, fd, 0) != MAP_FAILED)
+            {
+                m_data = reinterpret_cast<short *>(base);
+                m_size = size;
+                m_mapped = true;
+                m_huge_pages = huge_pages;
+                res = true;
+            }
+            else
+            {
+                munmap(addr, 2 * bytes);
+            }
+        }
+    }
+    close(fd); // mappings keep the memory
+    return res;
+#else
+    (void)size;
+    (void)huge_pages;
+    return false;
+#endif
 }
 
 //---------------------------------------------------------------------------------------------------
-void CBuffer::consume(size_t len)
+void CMirroredStorage::allocate(size_t size, RingMemoryOptions const &options)
 {
-    if (elementsAvailable() < len)
+    release();
+    if (size == 0)
     {
-        // should never happen, but for some reason
-        m_head = 0;
-        m_tail = 0;
         return;
     }
 
-    m_tail += len;
-    if (m_tail >= m_buffer.size())
+    if (!(options.huge_pages && map(size, true)) && !map(size, false))
+    {
+        m_copy.resize(2 * size);
+        m_data = m_copy.data();
+        m_size = size;
+    }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (options.huge_pages && m_mapped && !m_huge_pages)
+    {
+        madvise(m_data, 2 * size * sizeof(short), MADV_HUGEPAGE); // shmem THP, if enabled in /sys/kernel/mm/transparent_hugepage
+    }
+#endif
+
+    if (options.lock)
     {
-        m_tail -= m_buffer.size();
+        m_locked = lock_memory(m_data, 2 * size * sizeof(short));
     }
 }
 
 //---------------------------------------------------------------------------------------------------
-void CBuffer::peek(short *buf, size_t len) const
+void CMirroredStorage::write(size_t pos, const short *buf, size_t len)
 {
-    if (m_tail + len < m_buffer.size())
+    memcpy(m_data + pos, buf, len * sizeof(short));
+    if (m_mapped)
+    {
+        return;
+    }
+
+    // software mirror: the other copy of the same elements
+    if (pos + len <= m_size)
     {
-        memcpy(buf, &m_buffer[m_tail], len * sizeof(short));
+        memcpy(m_data + pos + m_size, buf, len * sizeof(short));
     }
     else
     {
-        size_t len1 = m_buffer.size() - m_tail;
+        size_t len1 = m_size - pos;
         size_t len2 = len - len1;
-        memcpy(buf, &m_buffer[m_tail], len1 * sizeof(short));
-        memcpy(buf + len1, &m_buffer[0], len2 * sizeof(short));
+        memcpy(m_data + pos + m_size, buf, len1 * sizeof(short));
+        memcpy(m_data, buf + len1, len2 * sizeof(short));
     }
 }
 
 //---------------------------------------------------------------------------------------------------
-void CBuffer::peek(std::vector<short> &buffer, size_t len) const
+void CSharedRing::put(const short *buf, size_t len)
 {
-    size_t len2 = (len > buffer.size()) ? buffer.size() : len; // limit length for some reason
-    peek(&buffer[0], len2);
+    const size_t size = m_buffer.size();
+
+    // ignore huge data (should never happen)
+    if (len >= size)
+        return;
+
+    const std::uint64_t head = m_head.load(std::memory_order_relaxed);
+    m_buffer.write(static_cast<size_t>(head % size), buf, len);
+
+    m_head.store(head + len, std::memory_order_release);
 }
 
 //---------------------------------------------------------------------------------------------------
-void CBuffer::put(const short *buf, size_t len)
+const short *CSharedRing::data() const
 {
-    // ignore huge data (should never happen)
-    if (len >= m_buffer.size())
-        return;
+    return m_buffer.data();
+}
+
+//---------------------------------------------------------------------------------------------------
+size_t CSharedRing::size() const
+{
+    return m_buffer.size();
+}
+
+//---------------------------------------------------------------------------------------------------
+std::uint64_t CSharedRing::writePosition() const
+{
+    return m_head.load(std::memory_order_acquire);
+}
+
+//---------------------------------------------------------------------------------------------------
+void CSharedRing::allocate(size_t bufferSize, RingMemoryOptions const &options)
+{
+    m_buffer.allocate(bufferSize, options); // releases old memory
+    m_head.store(0);
+}
+
+//---------------------------------------------------------------------------------------------------
+CMirroredStorage const &CSharedRing::storage() const
+{
+    return m_buffer;
+}
+
+//---------------------------------------------------------------------------------------------------
+bool CRingReader::has_space(size_t len) const
+{
+    return m_ring->writePosition() + len <= m_tail.load(std::memory_order_acquire) + m_ring->size();
+}
 
-    size_t elementsAvailableBefore = elementsAvailable();
+//---------------------------------------------------------------------------------------------------
+bool CRingReader::prepare_put(size_t len)
+{
+    m_put_in_progress.store(true, std::memory_order_seq_cst); // pairs with keep_unread_data()
 
-    if (m_head + len < m_buffer.size())
+    if (len >= m_ring->size())
     {
-        memcpy(&m_buffer[m_head], buf, len * sizeof(short));
-        m_head += len;
+        return false; // can't be stored at all (should never happen)
     }
-    else
+
+    if (has_space(len))
     {
-        size_t len1 = m_buffer.size() - m_head;
-        size_t len2 = len - len1;
-        memcpy(&m_buffer[m_head], buf, len1 * sizeof(short));
-        memcpy(&m_buffer[0], buf + len1, len2 * sizeof(short));
-        m_head = len2;
+        return true;
     }
 
-    // check buffer overflow
-    if (elementsAvailableBefore + len >= m_buffer.size())
+    if (m_keep_unread.load(std::memory_order_seq_cst))
     {
-        // When overflow occurs we move tail next of head for some number of bytes (cut old unreaded data)
-        // Why 32? Well, it can be at least 2 elements, bit 32 is a good value in terms of memory alignment.
-        m_tail = m_head + 32;
-        if (m_tail >= m_buffer.size())
+        return false; // consumer may hold pointers to unread data
+    }
+
+    // DropNewest and Block: consumer wants no gaps inside of queued data. The producer never waits for the consumer,
+    // it would stop receiving and starve other readers.
+    return static_cast<OverflowPolicy>(m_policy.load(std::memory_order_seq_cst)) == OverflowPolicy::DropOldest;
+}
+
+//---------------------------------------------------------------------------------------------------
+void CRingReader::make_room(size_t len)
+{
+    // Cut old unreaded data. The consumer may move tail concurrently, so only move it forward.
+    const std::uint64_t head = m_ring->writePosition();
+    const size_t size = m_ring->size();
+    if (len >= size || head + len <= size)
+    {
+        return;
+    }
+
+    const std::uint64_t min_tail = head + len - size;
+    std::uint64_t tail = m_tail.load(std::memory_order_acquire);
+    while (tail < min_tail)
+    {
+        if (m_tail.compare_exchange_weak(tail, min_tail, std::memory_order_acq_rel, std::memory_order_acquire))
         {
-            m_tail -= m_buffer.size();
+            m_dropped.fetch_add(min_tail - tail, std::memory_order_relaxed);
+            break;
         }
     }
 }
 
 //---------------------------------------------------------------------------------------------------
-size_t CBuffer::elementsAvailable() const
+void CRingReader::drop_put(size_t len)
+{
+    m_dropped.fetch_add(len, std::memory_order_relaxed);
+}
+
+//---------------------------------------------------------------------------------------------------
+void CRingReader::end_put()
+{
+    m_put_in_progress.store(false, std::memory_order_release);
+}
+
+//---------------------------------------------------------------------------------------------------
+void CRingReader::copy_out(std::uint64_t pos64, short *buf, size_t len) const
+{
+    // ring is mirrored, never wraps
+    memcpy(buf, m_ring->data() + static_cast<size_t>(pos64 % m_ring->size()), len * sizeof(short));
+}
+
+//---------------------------------------------------------------------------------------------------
+size_t CRingReader::read(short *buf, size_t len, std::uint64_t *pos)
 {
-    int s = static_cast<int>(m_head) - static_cast<int>(m_tail);
-    if (s < 0)
+    if (m_ring == nullptr)
     {
-        s += static_cast<int>(m_buffer.size());
+        return 0;
     }
-    return s;
+
+    for (;;)
+    {
+        std::uint64_t tail = m_tail.load(std::memory_order_acquire);
+        const std::uint64_t head = m_ring->writePosition();
+        if (head <= tail)
+        {
+            return 0;
+        }
+
+        const size_t n = static_cast<size_t>(std::min<std::uint64_t>({head - tail, len, m_ring->size()}));
+        copy_out(tail, buf, n);
+
+        // Commit. If producer has moved tail meanwhile, the data we copied could be overwritten - try again.
+        if (m_tail.compare_exchange_strong(tail, tail + n, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            if (pos)
+            {
+                *pos = tail;
+            }
+            return n;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------
+const short *CRingReader::dataAt(std::uint64_t pos) const
+{
+    return m_ring->data() + static_cast<size_t>(pos % m_ring->size());
+}
+
+//---------------------------------------------------------------------------------------------------
+bool CRingReader::commit(std::uint64_t from, size_t len)
+{
+    // Data at [from, from + len) is valid only if the producer didn't move tail after it was read.
+    return m_tail.compare_exchange_strong(from, from + len, std::memory_order_acq_rel, std::memory_order_acquire);
+}
+
+//---------------------------------------------------------------------------------------------------
+const short *CRingReader::acquire(size_t len, std::uint64_t *pos)
+{
+    if (m_ring == nullptr || m_ring->size() == 0)
+    {
+        return nullptr;
+    }
+
+    const std::uint64_t pos64 = readPosition();
+    const std::uint64_t head = m_ring->writePosition();
+
+    // mirrored ring: acquired memory is contiguous even if it wraps
+    if (head < pos64 + len || len > m_ring->size())
+    {
+        return nullptr;
+    }
+
+    if (m_acquired == 0)
+    {
+        m_release_pos = pos64;
+    }
+    m_acquired += len;
+    if (pos)
+    {
+        *pos = pos64;
+    }
+    return m_ring->data() + static_cast<size_t>(pos64 % m_ring->size());
+}
+
+//---------------------------------------------------------------------------------------------------
+void CRingReader::release(size_t len)
+{
+    if (len > m_acquired)
+    {
+        // should never happen
+        len = static_cast<size_t>(m_acquired);
+    }
+    m_acquired -= len;
+    m_release_pos += len;
+
+    // Tail is pinned by keep_unread_data(), but never move it back if the producer has moved it past released data anyway.
+    std::uint64_t tail = m_tail.load(std::memory_order_acquire);
+    while (tail < m_release_pos && !m_tail.compare_exchange_weak(tail, m_release_pos, std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+    }
+}
+
+//---------------------------------------------------------------------------------------------------
+size_t CRingReader::elementsAcquired() const
+{
+    return static_cast<size_t>(m_acquired);
+}
+
+//---------------------------------------------------------------------------------------------------
+void CRingReader::keep_unread_data()
+{
+    if (m_keep_unread.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    m_keep_unread.store(true, std::memory_order_seq_cst);
+
+    // Wait for put which might have seen the old value. Any later put sees the new one.
+    while (m_put_in_progress.load(std::memory_order_seq_cst))
+    {
+        std::this_thread::yield();
+    }
+}
+
+//---------------------------------------------------------------------------------------------------
+void CRingReader::attach(CSharedRing *ring)
+{
+    m_ring = ring;
+    reset();
+}
+
+//---------------------------------------------------------------------------------------------------
+void CRingReader::setOverflowPolicy(OverflowPolicy policy)
+{
+    m_policy.store(static_cast<int>(policy), std::memory_order_seq_cst);
+}
+
+//---------------------------------------------------------------------------------------------------
+void CRingReader::reset()
+{
+    m_tail.store(m_ring ? m_ring->writePosition() : 0);
+    m_dropped.store(0);
+    m_keep_unread.store(false);
+    m_acquired = 0;
+    m_release_pos = 0;
+}
+
+//---------------------------------------------------------------------------------------------------
+const short *CRingReader::data() const
+{
+    return m_ring ? m_ring->data() : nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------
+size_t CRingReader::size() const
+{
+    return m_ring ? m_ring->size() : 0;
+}
+
+//---------------------------------------------------------------------------------------------------
+std::uint64_t CRingReader::readPosition() const
+{
+    const std::uint64_t tail = m_tail.load(std::memory_order_acquire);
+    return (m_acquired == 0) ? tail : std::max(tail, m_release_pos + m_acquired);
+}
+
+//---------------------------------------------------------------------------------------------------
+size_t CRingReader::elementsAvailable() const
+{
+    if (m_ring == nullptr)
+    {
+        return 0;
+    }
+
+    const std::uint64_t pos = readPosition();
+    const std::uint64_t head = m_ring->writePosition();
+    if (head <= pos)
+    {
+        return 0;
+    }
+    return static_cast<size_t>(std::min<std::uint64_t>(head - pos, m_ring->size()));
+}
+
+//---------------------------------------------------------------------------------------------------
+size_t CRingReader::elementsQueued() const
+{
+    if (m_ring == nullptr)
+    {
+        return 0;
+    }
+
+    const std::uint64_t tail = m_tail.load(std::memory_order_acquire);
+    const std::uint64_t head = m_ring->writePosition();
+    return (head <= tail) ? 0 : static_cast<size_t>(std::min<std::uint64_t>(head - tail, m_ring->size()));
 }
 
 //---------------------------------------------------------------------------------------------------
-void CBuffer::reset()
+size_t CRingReader::elementsDropped() const
 {
-    m_head = 0;
-    m_tail = 0;
+    return static_cast<size_t>(m_dropped.load(std::memory_order_relaxed));
 }
@@ -7,23 +7,193 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <vector>
 
-// Ring buffer
-class CBuffer
+// Backing of ring memory. Both options work on Linux only, if not granted ordinary memory is used.
+struct RingMemoryOptions
+{
+    bool huge_pages{false}; // hugetlbfs pages (reserved by vm.nr_hugepages), otherwise transparent huge pages are advised
+    bool lock{false};       // mlock, so the producer never takes a page fault on the ring
+};
+
+// Ring memory of `size` elements addressable as 2 * size elements: element i is also at i + size,
+// so any range of up to `size` elements starting inside of the ring is contiguous.
+// On Linux the same memfd pages are mapped twice back to back, elsewhere (or if mapping fails) the writer stores data twice.
+class CMirroredStorage
 {
   public:
-    CBuffer(size_t bufferSize);
-    ~CBuffer() = default;
+    CMirroredStorage() = default;
+    ~CMirroredStorage();
+    CMirroredStorage(CMirroredStorage const &) = delete;
+    CMirroredStorage &operator=(CMirroredStorage const &) = delete;
+
+    // Zero filled and prefaulted, old data is released. Mapped only if size is multiple of granularity().
+    void allocate(size_t size, RingMemoryOptions const &options = RingMemoryOptions());
+    void write(size_t pos, const short *buf, size_t len); // pos < size, len <= size
+
+    const short *data() const
+    {
+        return m_data;
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+    bool mapped() const
+    {
+        return m_mapped;
+    }
+    bool hugePages() const
+    {
+        return m_huge_pages;
+    }
+    bool locked() const
+    {
+        return m_locked;
+    }
+
+    static size_t granularity(bool huge_pages = false); // in elements, page or huge page size on Linux
+
+  private:
+    void release();
+    bool map(size_t size, bool huge_pages);
+
+    short *m_data{nullptr};
+    size_t m_size{0};
+    bool m_mapped{false}; // true - double mapping, false - m_copy holds two copies of data
+    bool m_huge_pages{false};
+    bool m_locked{false};
+    std::vector<short> m_copy{};
+};
+
+// What the producer does when a reader has no space for new data.
+// A ring shared by several readers is always written, so its readers are DropOldest; other policies need a ring of the reader's own.
+enum class OverflowPolicy
+{
+    DropOldest = 0, // overwrite the oldest data of the reader, whole put chunks (packets) at a time. Minimum latency.
+    DropNewest = 1, // keep queued data of the reader, discard new data
+    Block = 2,      // as DropNewest, the producer never waits. Its ring gets extra room instead, see calc_ring_len() of the driver.
+};
+
+// Lock-free ring buffer storage for exactly one producer thread, shared by any number of readers (CRingReader).
+// Data is copied into the ring once, no matter how many readers are attached. Storage is mirrored, so reads never wrap.
+// Head is a monotonic element counter; the producer publishes data with a release store of head.
+class CSharedRing
+{
+  public:
+    CSharedRing() = default;
+    CSharedRing(CSharedRing const &) = delete;
+    CSharedRing &operator=(CSharedRing const &) = delete;
+
+    // producer side. Readers must be prepared by CRingReader::prepare_put()/make_room() before.
     void put(const short *buf, size_t len);
+
+    const short *data() const; // mirrored: up to size() elements from any position inside of the ring are contiguous
+    size_t size() const;
+    std::uint64_t writePosition() const; // stream position of the next element to put
+
+    // only when producer and readers are not active, drops all data
+    void allocate(size_t bufferSize, RingMemoryOptions const &options = RingMemoryOptions());
+    CMirroredStorage const &storage() const;
+
+  private:
+    CMirroredStorage m_buffer;
+    std::atomic<std::uint64_t> m_head{0}; // written by producer only
+};
+
+// Cursor of exactly one consumer thread in CSharedRing.
+// The consumer commits a read with CAS of tail. On overflow the producer drops the oldest data of the reader by moving its tail forward,
+// which makes the CAS of a concurrent read fail, so the reader retries with fresh data instead of returning torn data.
+class CRingReader
+{
+  public:
+    CRingReader() = default;
+    CRingReader(CRingReader const &) = delete;
+    CRingReader &operator=(CRingReader const &) = delete;
+
+    // producer side, for every put to the ring:
+    // prepare_put(), then make_room() if it returned true, otherwise drop_put() (the reader's own ring is not written); then end_put().
+    // Readers of a shared ring are DropOldest and never refuse.
+    bool prepare_put(size_t len); // false if the reader doesn't allow to overwrite its unread data
+    void make_room(size_t len);   // drop the oldest data which will be overwritten
+    void drop_put(size_t len);    // new data is discarded
+    void end_put();
+
+    // consumer side
     size_t elementsAvailable() const;
-    void peek(short *buf, size_t len) const;
-    void peek(std::vector<short> &buffer, size_t len) const;
-    void consume(size_t len);
-    void reset();
+    size_t elementsQueued() const; // any thread, not read yet including acquired elements
+    // copy and consume up to len elements, returns number of elements read. `pos` gets stream position of the first one.
+    size_t read(short *buf, size_t len, std::uint64_t *pos = nullptr);
+    // Same as read() without intermediate copy: `consume(const short *src, size_t n)` gets up to len contiguous elements in the ring.
+    // It must only copy or convert them out: if the producer overwrote them meanwhile, it is called again with fresh data.
+    template <class Consume> size_t readInPlace(size_t len, Consume consume, std::uint64_t *pos = nullptr);
+
+    // consumer side, reading at positions chosen by the caller (e.g. to align several readers). Don't mix with acquire().
+    const short *dataAt(std::uint64_t pos) const; // up to size() contiguous elements from stream position `pos`
+    bool commit(std::uint64_t from, size_t len);   // consume `len` elements read from `from`, false if producer moved tail meanwhile
+
+    // consumer side, zero copy access. Don't mix with read(). The ring must be the reader's own, see keep_unread_data().
+    const short *acquire(size_t len, std::uint64_t *pos = nullptr); // pointer to next `len` contiguous elements or nullptr
+    void release(size_t len);          // consume elements acquired earlier (in the same order)
+    void keep_unread_data();           // whatever the policy, refuse puts which would overwrite unread (and acquired) data
+    size_t elementsAcquired() const;   // consumer side, acquired and not released yet
+
+    // only when producer is not active
+    void attach(CSharedRing *ring);
+    void setOverflowPolicy(OverflowPolicy policy);
+    void reset(); // start reading from current ring head
+
+    const short *data() const;
+    size_t size() const;
+    std::uint64_t readPosition() const; // consumer side, stream position of the next element to read or acquire
+    size_t elementsDropped() const;     // total number of elements this reader lost due to overflow
 
   private:
-    std::vector<short> m_buffer;
-    size_t m_head;
-    size_t m_tail;
+    void copy_out(std::uint64_t pos, short *buf, size_t len) const;
+    bool has_space(size_t len) const;
+
+    CSharedRing *m_ring{nullptr};
+    std::atomic<std::uint64_t> m_tail{0}; // moved forward by consumer (read) or by producer (overflow)
+    std::atomic<std::uint64_t> m_dropped{0};
+    std::atomic<int> m_policy{static_cast<int>(OverflowPolicy::DropOldest)};
+    std::atomic<bool> m_put_in_progress{false};
+    std::atomic<bool> m_keep_unread{false};
+    std::uint64_t m_acquired{0};    // consumer only
+    std::uint64_t m_release_pos{0}; // consumer only, stream position of the first acquired element
 };
+
+//---------------------------------------------------------------------------------------------------
+template <class Consume> size_t CRingReader::readInPlace(size_t len, Consume consume, std::uint64_t *pos)
+{
+    if (m_ring == nullptr)
+    {
+        return 0;
+    }
+
+    for (;;)
+    {
+        std::uint64_t tail = m_tail.load(std::memory_order_acquire);
+        const std::uint64_t head = m_ring->writePosition();
+        if (head <= tail)
+        {
+            return 0;
+        }
+
+        const size_t n = static_cast<size_t>(std::min<std::uint64_t>(std::min<std::uint64_t>(head - tail, len), m_ring->size()));
+        consume(m_ring->data() + static_cast<size_t>(tail % m_ring->size()), n);
+
+        // Commit. If producer has moved tail meanwhile, the data we consumed could be overwritten - try again.
+        if (m_tail.compare_exchange_strong(tail, tail + n, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            if (pos)
+            {
+                *pos = tail;
+            }
+            return n;
+        }
+    }
+}
@@ -0,0 +1,168 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "ddc.hpp"
+
+#include "dot_product.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+constexpr double PI = 3.14159265358979323846;
+constexpr float F_SCALE = 1.0f / 32768.0f;
+constexpr size_t block_samples = 4096; // input samples mixed at once, NCO is re-anchored at every block
+constexpr size_t taps_align = 16;      // filter length is padded to the widest SIMD loop
+
+const char *Ddc::impl_name()
+{
+    return dot2_impl_name();
+}
+
+Ddc::Ddc(double shift, size_t decimation, size_t taps_per_phase)
+    : _shift(shift), _decimation(std::max<size_t>(decimation, 1))
+{
+    const double step = -2.0 * PI * _shift * 8;
+    _step8_re = static_cast<float>(std::cos(step));
+    _step8_im = static_cast<float>(std::sin(step));
+
+    if (_decimation > 1)
+    {
+        // Blackman windowed sinc, cut off at output Nyquist frequency, unity gain at 0 Hz
+        const size_t len = std::max<size_t>(taps_per_phase, 2) * _decimation;
+        const double fc = 0.5 / static_cast<double>(_decimation);
+        const double center = (static_cast<double>(len) - 1.0) / 2.0;
+        std::vector<double> h(len);
+        double sum = 0.0;
+        for (size_t j = 0; j < len; j++)
+        {
+            const double x = static_cast<double>(j) - center;
+            const double sinc = (x == 0.0) ? 1.0 : std::sin(2.0 * PI * fc * x) / (2.0 * PI * fc * x);
+            const double w = 2.0 * PI * static_cast<double>(j) / static_cast<double>(len - 1);
+            h[j] = sinc * (0.42 - 0.5 * std::cos(w) + 0.08 * std::cos(2.0 * w));
+            sum += h[j];
+        }
+
+        // Reversed, zero padding goes to the oldest end, so delay is not changed.
+        _num_taps = (len + taps_align - 1) / taps_align * taps_align;
+        _taps.assign(_num_taps, 0.0f);
+        for (size_t j = 0; j < len; j++)
+        {
+            _taps[_num_taps - 1 - j] = static_cast<float>(h[j] / sum);
+        }
+        _group_delay = center;
+    }
+
+    _hist_i.assign(_num_taps - 1 + block_samples, 0.0f);
+    _hist_q.assign(_num_taps - 1 + block_samples, 0.0f);
+}
+
+void Ddc::reset()
+{
+    std::fill(_hist_i.begin(), _hist_i.end(), 0.0f);
+    std::fill(_hist_q.begin(), _hist_q.end(), 0.0f);
+    _phase = 0;
+    _nco_phase = 0.0;
+}
+
+size_t Ddc::input_for(size_t num_out) const
+{
+    return (num_out == 0) ? 0 : (_decimation - _phase) + (num_out - 1) * _decimation;
+}
+
+double Ddc::group_delay() const
+{
+    return _group_delay;
+}
+
+double Ddc::output_offset() const
+{
+    return static_cast<double>(input_for(1) - 1) - _group_delay; // computed at its newest input sample
+}
+
+size_t Ddc::max_output(size_t len) const
+{
+    return len / 2 / _decimation + 1;
+}
+
+// Multiply by NCO phasor exp(-j*2*pi*shift*n). Phasors of 8 consecutive samples are rotated together,
+// so the inner loop has no dependency between samples and is vectorized by compiler.
+void Ddc::mix(const short *src, size_t num_samples, float *dst_i, float *dst_q)
+{
+    float lane_re[8];
+    float lane_im[8];
+    for (int l = 0; l < 8; l++)
+    {
+        const double a = -2.0 * PI * (_nco_phase + _shift * l); // exact start of every block, float rotation drifts
+        lane_re[l] = static_cast<float>(std::cos(a));
+        lane_im[l] = static_cast<float>(std::sin(a));
+    }
+
+    size_t n = 0;
+    for (; n + 8 <= num_samples; n += 8)
+    {
+        for (int l = 0; l < 8; l++)
+        {
+            const float xi = static_cast<float>(src[2 * (n + l)]) * F_SCALE;
+            const float xq = static_cast<float>(src[2 * (n + l) + 1]) * F_SCALE;
+            dst_i[n + l] = xi * lane_re[l] - xq * lane_im[l];
+            dst_q[n + l] = xi * lane_im[l] + xq * lane_re[l];
+        }
+        for (int l = 0; l < 8; l++)
+        {
+            const float re = lane_re[l] * _step8_re - lane_im[l] * _step8_im;
+            lane_im[l] = lane_re[l] * _step8_im + lane_im[l] * _step8_re;
+            lane_re[l] = re;
+        }
+    }
+    for (size_t l = 0; n + l < num_samples; l++)
+    {
+        const float xi = static_cast<float>(src[2 * (n + l)]) * F_SCALE;
+        const float xq = static_cast<float>(src[2 * (n + l) + 1]) * F_SCALE;
+        dst_i[n + l] = xi * lane_re[l] - xq * lane_im[l];
+        dst_q[n + l] = xi * lane_im[l] + xq * lane_re[l];
+    }
+
+    _nco_phase += _shift * static_cast<double>(num_samples);
+    _nco_phase -= std::floor(_nco_phase);
+}
+
+size_t Ddc::run_block(const short *src, size_t num_samples, float *out)
+{
+    const size_t hist_len = _num_taps - 1;
+    mix(src, num_samples, &_hist_i[hist_len], &_hist_q[hist_len]);
+
+    size_t num_out = 0;
+    if (_num_taps == 1)
+    {
+        for (size_t n = 0; n < num_samples; n++)
+        {
+            out[2 * n] = _hist_i[n];
+            out[2 * n + 1] = _hist_q[n];
+        }
+        return num_samples;
+    }
+
+    // Polyphase decimation: the filter is evaluated only for samples which are kept.
+    const Dot2Func dot2 = dot2_func();
+    for (size_t t = _decimation - 1 - _phase; t < num_samples; t += _decimation)
+    {
+        dot2(_taps.data(), &_hist_i[t], &_hist_q[t], _num_taps, &out[2 * num_out], &out[2 * num_out + 1]);
+        num_out++;
+    }
+    _phase = (_phase + num_samples) % _decimation;
+
+    // keep the newest samples as history of the next block
+    std::memmove(_hist_i.data(), &_hist_i[num_samples], hist_len * sizeof(float));
+    std::memmove(_hist_q.data(), &_hist_q[num_samples], hist_len * sizeof(float));
+    return num_out;
+}
+
+size_t Ddc::process(const short *src, size_t len, float *out)
+{
+    size_t num_out = 0;
+    for (size_t n = 0; n < len / 2; n += block_samples)
+    {
+        num_out += run_block(src + 2 * n, std::min(block_samples, len / 2 - n), out + 2 * num_out);
+    }
+    return num_out;
+}
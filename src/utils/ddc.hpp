@@ -0,0 +1,54 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include "sample_processor.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// Digital down-converter of one channel: NCO frequency shift followed by polyphase FIR decimation.
+// Input is CS16 I+Q, output is I+Q floats (full scale 1.0) or CS16. Not thread safe.
+class Ddc : public SampleProcessor
+{
+  public:
+    static constexpr size_t default_taps_per_phase = 24;
+
+    // The signal at `shift` (cycles per input sample, -0.5..0.5) is moved to 0 Hz, then the rate is divided by `decimation`.
+    // The low-pass filter has `taps_per_phase` taps in each of `decimation` polyphase branches.
+    Ddc(double shift, size_t decimation, size_t taps_per_phase = default_taps_per_phase);
+
+    using SampleProcessor::process;
+    size_t process(const short *src, size_t len, float *out) override;
+
+    size_t input_for(size_t num_out) const override;
+    double output_offset() const override;
+    void reset() override;      // drop filter history, NCO starts from zero phase
+    double group_delay() const; // delay of the filter in input samples
+
+    size_t decimation() const
+    {
+        return _decimation;
+    }
+
+    static const char *impl_name(); // SIMD implementation of the filter selected for this CPU. For logging.
+
+  protected:
+    size_t max_output(size_t len) const override;
+
+  private:
+    size_t run_block(const short *src, size_t num_samples, float *out);
+    void mix(const short *src, size_t num_samples, float *dst_i, float *dst_q);
+
+    double _shift;
+    size_t _decimation;
+    size_t _num_taps{1};           // padded with zeros to SIMD width, 1 - no filter
+    double _group_delay{0.0};
+    std::vector<float> _taps;      // reversed: the last tap is for the newest sample
+    std::vector<float> _hist_i;    // _num_taps - 1 previous samples, then samples of current block
+    std::vector<float> _hist_q;
+    size_t _phase{0};              // input samples since last output sample, < _decimation
+    double _nco_phase{0.0};        // cycles, 0..1
+    float _step8_re{1.0f};         // NCO rotation for 8 samples
+    float _step8_im{0.0f};
+};
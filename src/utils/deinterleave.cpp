@@ -0,0 +1,145 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "deinterleave.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DEINTERLEAVE_SSE2 1
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DEINTERLEAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+// One I+Q pair is 32 bits, so deinterleaving is a transposition of 32-bit words.
+// SIMD versions use float shuffles which move bits without any conversion.
+
+template <size_t NumChannels>
+static size_t deinterleave_scalar(const short *src, size_t len, short *const *dst, size_t pos)
+{
+    for (size_t idx = 0; idx + 2 * NumChannels <= len; idx += 2 * NumChannels)
+    {
+        for (size_t channel = 0; channel < NumChannels; channel++)
+        {
+            // Take I+Q pair from UDP rx stream and put to specified channel's buffer
+            dst[channel][pos] = src[idx + 2 * channel];
+            dst[channel][pos + 1] = src[idx + 2 * channel + 1];
+        }
+        pos += 2; // step on one I+Q pair
+    }
+    return pos;
+}
+
+template <size_t NumChannels> struct Deinterleaver
+{
+    static size_t run(const short *src, size_t len, short *const *dst, size_t pos)
+    {
+        return deinterleave_scalar<NumChannels>(src, len, dst, pos);
+    }
+};
+
+template <> struct Deinterleaver<1>
+{
+    static size_t run(const short *src, size_t len, short *const *dst, size_t pos)
+    {
+        std::memcpy(dst[0] + pos, src, len * sizeof(short));
+        return pos + len;
+    }
+};
+
+#if defined(DEINTERLEAVE_SSE2)
+
+template <> struct Deinterleaver<2>
+{
+    static size_t run(const short *src, size_t len, short *const *dst, size_t pos)
+    {
+        size_t idx = 0;
+        for (; idx + 16 <= len; idx += 16)
+        {
+            const __m128 x = _mm_loadu_ps(reinterpret_cast<const float *>(src + idx));     // a0 b0 a1 b1
+            const __m128 y = _mm_loadu_ps(reinterpret_cast<const float *>(src + idx + 8)); // a2 b2 a3 b3
+            _mm_storeu_ps(reinterpret_cast<float *>(dst[0] + pos), _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(reinterpret_cast<float *>(dst[1] + pos), _mm_shuffle_ps(x, y, _MM_SHUFFLE(3, 1, 3, 1)));
+            pos += 8;
+        }
+        return deinterleave_scalar<2>(src + idx, len - idx, dst, pos);
+    }
+};
+
+template <> struct Deinterleaver<4>
+{
+    static size_t run(const short *src, size_t len, short *const *dst, size_t pos)
+    {
+        size_t idx = 0;
+        for (; idx + 32 <= len; idx += 32)
+        {
+            __m128 r0 = _mm_loadu_ps(reinterpret_cast<const float *>(src + idx));      // a0 b0 c0 d0
+            __m128 r1 = _mm_loadu_ps(reinterpret_cast<const float *>(src + idx + 8));  // a1 b1 c1 d1
+            __m128 r2 = _mm_loadu_ps(reinterpret_cast<const float *>(src + idx + 16)); // a2 b2 c2 d2
+            __m128 r3 = _mm_loadu_ps(reinterpret_cast<const float *>(src + idx + 24)); // a3 b3 c3 d3
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(reinterpret_cast<float *>(dst[0] + pos), r0);
+            _mm_storeu_ps(reinterpret_cast<float *>(dst[1] + pos), r1);
+            _mm_storeu_ps(reinterpret_cast<float *>(dst[2] + pos), r2);
+            _mm_storeu_ps(reinterpret_cast<float *>(dst[3] + pos), r3);
+            pos += 8;
+        }
+        return deinterleave_scalar<4>(src + idx, len - idx, dst, pos);
+    }
+};
+
+#elif defined(DEINTERLEAVE_NEON)
+
+template <> struct Deinterleaver<2>
+{
+    static size_t run(const short *src, size_t len, short *const *dst, size_t pos)
+    {
+        size_t idx = 0;
+        for (; idx + 16 <= len; idx += 16)
+        {
+            const uint32x4x2_t v = vld2q_u32(reinterpret_cast<const uint32_t *>(src + idx));
+            vst1q_u32(reinterpret_cast<uint32_t *>(dst[0] + pos), v.val[0]);
+            vst1q_u32(reinterpret_cast<uint32_t *>(dst[1] + pos), v.val[1]);
+            pos += 8;
+        }
+        return deinterleave_scalar<2>(src + idx, len - idx, dst, pos);
+    }
+};
+
+template <> struct Deinterleaver<4>
+{
+    static size_t run(const short *src, size_t len, short *const *dst, size_t pos)
+    {
+        size_t idx = 0;
+        for (; idx + 32 <= len; idx += 32)
+        {
+            const uint32x4x4_t v = vld4q_u32(reinterpret_cast<const uint32_t *>(src + idx));
+            vst1q_u32(reinterpret_cast<uint32_t *>(dst[0] + pos), v.val[0]);
+            vst1q_u32(reinterpret_cast<uint32_t *>(dst[1] + pos), v.val[1]);
+            vst1q_u32(reinterpret_cast<uint32_t *>(dst[2] + pos), v.val[2]);
+            vst1q_u32(reinterpret_cast<uint32_t *>(dst[3] + pos), v.val[3]);
+            pos += 8;
+        }
+        return deinterleave_scalar<4>(src + idx, len - idx, dst, pos);
+    }
+};
+
+#endif
+
+DeinterleaveFunc select_deinterleaver(size_t num_channels)
+{
+    switch (num_channels)
+    {
+    case 1:
+        return &Deinterleaver<1>::run;
+    case 2:
+        return &Deinterleaver<2>::run;
+    case 3:
+        return &Deinterleaver<3>::run;
+    default:
+        return &Deinterleaver<4>::run;
+    }
+}
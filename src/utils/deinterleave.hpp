@@ -0,0 +1,12 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <cstddef>
+
+// Split UDP payload of `len` shorts (I+Q pairs of all channels in turn) to per channel buffers.
+// Data is written to dst[channel] starting from position `pos`. Returns new position.
+typedef size_t (*DeinterleaveFunc)(const short *src, size_t len, short *const *dst, size_t pos);
+
+// Returns implementation specialized for given number of channels (1,2,4 have SIMD versions).
+DeinterleaveFunc select_deinterleaver(size_t num_channels);
@@ -0,0 +1,163 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "dot_product.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DOT_X86_DISPATCH 1
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define DOT_X86_SSE2_ONLY 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DOT_NEON 1
+#include <arm_neon.h>
+#endif
+
+static void dot2_scalar(const float *taps, const float *a, const float *b, size_t n, float *ri, float *rq)
+{
+    float si = 0.0f;
+    float sq = 0.0f;
+    for (size_t j = 0; j < n; j++)
+    {
+        si += taps[j] * a[j];
+        sq += taps[j] * b[j];
+    }
+    *ri = si;
+    *rq = sq;
+}
+
+#if defined(DOT_X86_DISPATCH) || defined(DOT_X86_SSE2_ONLY)
+
+#if defined(DOT_X86_DISPATCH)
+__attribute__((target("sse2")))
+#endif
+static float hsum_sse2(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+#if defined(DOT_X86_DISPATCH)
+__attribute__((target("sse2")))
+#endif
+static void dot2_sse2(const float *taps, const float *a, const float *b, size_t n, float *ri, float *rq)
+{
+    __m128 si = _mm_setzero_ps();
+    __m128 sq = _mm_setzero_ps();
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4)
+    {
+        const __m128 t = _mm_loadu_ps(taps + j);
+        si = _mm_add_ps(si, _mm_mul_ps(t, _mm_loadu_ps(a + j)));
+        sq = _mm_add_ps(sq, _mm_mul_ps(t, _mm_loadu_ps(b + j)));
+    }
+    float ti;
+    float tq;
+    dot2_scalar(taps + j, a + j, b + j, n - j, &ti, &tq);
+    *ri = hsum_sse2(si) + ti;
+    *rq = hsum_sse2(sq) + tq;
+}
+
+#endif
+
+#if defined(DOT_X86_DISPATCH)
+
+__attribute__((target("avx2,fma"))) static float hsum_avx(__m256 v)
+{
+    const __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    return hsum_sse2(s);
+}
+
+__attribute__((target("avx2,fma"))) static void dot2_avx2(const float *taps, const float *a, const float *b, size_t n, float *ri,
+                                                          float *rq)
+{
+    // two accumulators per output hide latency of FMA
+    __m256 si0 = _mm256_setzero_ps();
+    __m256 si1 = _mm256_setzero_ps();
+    __m256 sq0 = _mm256_setzero_ps();
+    __m256 sq1 = _mm256_setzero_ps();
+    size_t j = 0;
+    for (; j + 16 <= n; j += 16)
+    {
+        const __m256 t0 = _mm256_loadu_ps(taps + j);
+        const __m256 t1 = _mm256_loadu_ps(taps + j + 8);
+        si0 = _mm256_fmadd_ps(t0, _mm256_loadu_ps(a + j), si0);
+        si1 = _mm256_fmadd_ps(t1, _mm256_loadu_ps(a + j + 8), si1);
+        sq0 = _mm256_fmadd_ps(t0, _mm256_loadu_ps(b + j), sq0);
+        sq1 = _mm256_fmadd_ps(t1, _mm256_loadu_ps(b + j + 8), sq1);
+    }
+    float ti;
+    float tq;
+    dot2_scalar(taps + j, a + j, b + j, n - j, &ti, &tq);
+    *ri = hsum_avx(_mm256_add_ps(si0, si1)) + ti;
+    *rq = hsum_avx(_mm256_add_ps(sq0, sq1)) + tq;
+}
+
+#endif
+
+#if defined(DOT_NEON)
+
+static void dot2_neon(const float *taps, const float *a, const float *b, size_t n, float *ri, float *rq)
+{
+    float32x4_t si = vdupq_n_f32(0.0f);
+    float32x4_t sq = vdupq_n_f32(0.0f);
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4)
+    {
+        const float32x4_t t = vld1q_f32(taps + j);
+        si = vmlaq_f32(si, t, vld1q_f32(a + j));
+        sq = vmlaq_f32(sq, t, vld1q_f32(b + j));
+    }
+    float ti;
+    float tq;
+    dot2_scalar(taps + j, a + j, b + j, n - j, &ti, &tq);
+    const float32x2_t hi = vadd_f32(vget_low_f32(si), vget_high_f32(si));
+    const float32x2_t hq = vadd_f32(vget_low_f32(sq), vget_high_f32(sq));
+    *ri = vget_lane_f32(vpadd_f32(hi, hi), 0) + ti;
+    *rq = vget_lane_f32(vpadd_f32(hq, hq), 0) + tq;
+}
+
+#endif
+
+struct Dot2Impl
+{
+    Dot2Func func;
+    const char *name;
+};
+
+static Dot2Impl select_impl()
+{
+#if defined(DOT_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return {dot2_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return {dot2_sse2, "sse2"};
+    }
+#elif defined(DOT_X86_SSE2_ONLY)
+    return {dot2_sse2, "sse2"};
+#elif defined(DOT_NEON)
+    return {dot2_neon, "neon"};
+#endif
+    return {dot2_scalar, "scalar"};
+}
+
+static Dot2Impl const &get_impl()
+{
+    static const Dot2Impl impl = select_impl();
+    return impl;
+}
+
+Dot2Func dot2_func()
+{
+    return get_impl().func;
+}
+
+const char *dot2_impl_name()
+{
+    return get_impl().name;
+}
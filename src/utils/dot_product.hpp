@@ -0,0 +1,12 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <cstddef>
+
+// Dot products of the same taps with I and Q: *ri = sum(taps[j] * a[j]), *rq = sum(taps[j] * b[j]), j < n.
+// Inner loop of FIR filters of DDC and resampler.
+typedef void (*Dot2Func)(const float *taps, const float *a, const float *b, size_t n, float *ri, float *rq);
+
+Dot2Func dot2_func();         // SIMD implementation selected by CPU features at first call
+const char *dot2_impl_name(); // name of the selected implementation. For logging.
@@ -0,0 +1,219 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "iq_correction.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IQ_CORRECTION_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#define IQ_CORRECTION_NEON 1
+#include <arm_neon.h>
+#endif
+
+constexpr float F_INT16MAX = 32768.0f;
+constexpr double tracking_alpha = 1.0 / 65536.0; // per sample, time constant of estimates is 64K samples
+
+void IqCorrector::set_dc_auto(bool value)
+{
+    _dc_auto.store(value, std::memory_order_relaxed);
+}
+
+bool IqCorrector::dc_auto() const
+{
+    return _dc_auto.load(std::memory_order_relaxed);
+}
+
+void IqCorrector::set_dc_offset(float i, float q)
+{
+    _dc_manual_i.store(i, std::memory_order_relaxed);
+    _dc_manual_q.store(q, std::memory_order_relaxed);
+}
+
+void IqCorrector::get_dc_offset(float &i, float &q) const
+{
+    if (dc_auto())
+    {
+        i = _dc_i.load(std::memory_order_relaxed) / F_INT16MAX;
+        q = _dc_q.load(std::memory_order_relaxed) / F_INT16MAX;
+    }
+    else
+    {
+        i = _dc_manual_i.load(std::memory_order_relaxed);
+        q = _dc_manual_q.load(std::memory_order_relaxed);
+    }
+}
+
+void IqCorrector::set_iq_auto(bool value)
+{
+    _iq_auto.store(value, std::memory_order_relaxed);
+}
+
+bool IqCorrector::iq_auto() const
+{
+    return _iq_auto.load(std::memory_order_relaxed);
+}
+
+void IqCorrector::set_iq_balance(float re, float im)
+{
+    _balance_re.store(re, std::memory_order_relaxed);
+    _balance_im.store(im, std::memory_order_relaxed);
+}
+
+// Update estimates with statistics of the block. Raw moments are integer sums, vectorized by compiler;
+// moments without DC are derived from them.
+void IqCorrector::estimate(const short *buf, size_t len)
+{
+    const size_t num_samples = len / 2;
+    if (num_samples == 0)
+    {
+        return;
+    }
+
+    std::int64_t sum_i = 0;
+    std::int64_t sum_q = 0;
+    std::int64_t sum_ii = 0;
+    std::int64_t sum_qq = 0;
+    std::int64_t sum_iq = 0;
+    for (size_t n = 0; n < num_samples; n++)
+    {
+        const std::int32_t i = buf[2 * n];
+        const std::int32_t q = buf[2 * n + 1];
+        sum_i += i;
+        sum_q += q;
+        sum_ii += i * i;
+        sum_qq += q * q;
+        sum_iq += i * q;
+    }
+
+    // one-pole filter with per sample coefficient, applied once per block
+    const double k = 1.0 - std::pow(1.0 - tracking_alpha, static_cast<double>(num_samples));
+    const double mean_i = static_cast<double>(sum_i) / num_samples;
+    const double mean_q = static_cast<double>(sum_q) / num_samples;
+
+    double dc_i = _dc_manual_i.load(std::memory_order_relaxed) * F_INT16MAX;
+    double dc_q = _dc_manual_q.load(std::memory_order_relaxed) * F_INT16MAX;
+    if (dc_auto())
+    {
+        dc_i = _dc_i.load(std::memory_order_relaxed);
+        dc_q = _dc_q.load(std::memory_order_relaxed);
+        dc_i += k * (mean_i - dc_i);
+        dc_q += k * (mean_q - dc_q);
+        _dc_i.store(static_cast<float>(dc_i), std::memory_order_relaxed);
+        _dc_q.store(static_cast<float>(dc_q), std::memory_order_relaxed);
+    }
+
+    if (iq_auto())
+    {
+        // E[(x - dx)(y - dy)] = E[xy] - dy E[x] - dx E[y] + dx dy
+        const double p_ii = static_cast<double>(sum_ii) / num_samples - 2.0 * dc_i * mean_i + dc_i * dc_i;
+        const double p_qq = static_cast<double>(sum_qq) / num_samples - 2.0 * dc_q * mean_q + dc_q * dc_q;
+        const double p_iq = static_cast<double>(sum_iq) / num_samples - dc_q * mean_i - dc_i * mean_q + dc_i * dc_q;
+        if (!_moments_valid)
+        {
+            _p_ii = p_ii;
+            _p_qq = p_qq;
+            _p_iq = p_iq;
+            _moments_valid = true;
+        }
+        else
+        {
+            _p_ii += k * (p_ii - _p_ii);
+            _p_qq += k * (p_qq - _p_qq);
+            _p_iq += k * (p_iq - _p_iq);
+        }
+    }
+    else
+    {
+        _moments_valid = false;
+    }
+}
+
+void IqCorrector::process(short *buf, size_t len)
+{
+    const bool dc_is_auto = dc_auto();
+    const bool iq_is_auto = iq_auto();
+    const float balance_re = _balance_re.load(std::memory_order_relaxed);
+    const float balance_im = _balance_im.load(std::memory_order_relaxed);
+    float dc_i = _dc_manual_i.load(std::memory_order_relaxed) * F_INT16MAX;
+    float dc_q = _dc_manual_q.load(std::memory_order_relaxed) * F_INT16MAX;
+    if (!dc_is_auto && !iq_is_auto && dc_i == 0.0f && dc_q == 0.0f && balance_re == 0.0f && balance_im == 0.0f)
+    {
+        return; // nothing to correct
+    }
+
+    if (dc_is_auto || iq_is_auto)
+    {
+        estimate(buf, len);
+    }
+    if (dc_is_auto)
+    {
+        dc_i = _dc_i.load(std::memory_order_relaxed);
+        dc_q = _dc_q.load(std::memory_order_relaxed);
+    }
+
+    // I' = m_ii I + m_iq Q, Q' = m_qi I + m_qq Q, after DC removal
+    float m_ii = 1.0f + balance_re;
+    float m_iq = balance_im;
+    float m_qi = balance_im;
+    float m_qq = 1.0f - balance_re;
+    if (iq_is_auto)
+    {
+        // Gram-Schmidt: remove the part of Q correlated with I, then scale Q to power of I
+        const double q_power = _p_qq - _p_iq * _p_iq / std::max(_p_ii, 1e-9);
+        if (_moments_valid && _p_ii > 1e-9 && q_power > 1e-9)
+        {
+            const double c = std::sqrt(_p_ii / q_power);
+            m_ii = 1.0f;
+            m_iq = 0.0f;
+            m_qi = static_cast<float>(-c * _p_iq / _p_ii);
+            m_qq = static_cast<float>(c);
+        }
+    }
+
+    size_t j = 0;
+#if defined(IQ_CORRECTION_SSE2)
+    const __m128 dc = _mm_setr_ps(dc_i, dc_q, dc_i, dc_q);
+    const __m128 direct = _mm_setr_ps(m_ii, m_qq, m_ii, m_qq);
+    const __m128 cross = _mm_setr_ps(m_iq, m_qi, m_iq, m_qi);
+    for (; j + 8 <= len; j += 8)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + j));
+        __m128 lo = _mm_sub_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), dc);
+        __m128 hi = _mm_sub_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), dc);
+        // swap I and Q of every sample for the cross terms
+        lo = _mm_add_ps(_mm_mul_ps(lo, direct), _mm_mul_ps(_mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 3, 0, 1)), cross));
+        hi = _mm_add_ps(_mm_mul_ps(hi, direct), _mm_mul_ps(_mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2, 3, 0, 1)), cross));
+        // round to nearest and saturate
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buf + j), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+    }
+#elif defined(IQ_CORRECTION_NEON)
+    const float dc_arr[4] = {dc_i, dc_q, dc_i, dc_q};
+    const float direct_arr[4] = {m_ii, m_qq, m_ii, m_qq};
+    const float cross_arr[4] = {m_iq, m_qi, m_iq, m_qi};
+    const float32x4_t dc = vld1q_f32(dc_arr);
+    const float32x4_t direct = vld1q_f32(direct_arr);
+    const float32x4_t cross = vld1q_f32(cross_arr);
+    for (; j + 8 <= len; j += 8)
+    {
+        const int16x8_t v = vld1q_s16(buf + j);
+        float32x4_t lo = vsubq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), dc);
+        float32x4_t hi = vsubq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), dc);
+        lo = vmlaq_f32(vmulq_f32(lo, direct), vrev64q_f32(lo), cross);
+        hi = vmlaq_f32(vmulq_f32(hi, direct), vrev64q_f32(hi), cross);
+        vst1q_s16(buf + j, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)), vqmovn_s32(vcvtnq_s32_f32(hi))));
+    }
+#endif
+
+    for (; j + 2 <= len; j += 2)
+    {
+        const float i = buf[j] - dc_i;
+        const float q = buf[j + 1] - dc_q;
+        const float out_i = std::min(std::max(m_ii * i + m_iq * q, -32768.0f), 32767.0f);
+        const float out_q = std::min(std::max(m_qi * i + m_qq * q, -32768.0f), 32767.0f);
+        buf[j] = static_cast<short>(std::lrint(out_i));
+        buf[j + 1] = static_cast<short>(std::lrint(out_q));
+    }
+}
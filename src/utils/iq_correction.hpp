@@ -0,0 +1,52 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// DC offset removal and IQ imbalance correction of CS16 I+Q samples of one hardware channel, done in place by RX thread
+// before data is put to the channel ring, so all streams of the channel get corrected data.
+// Settings may be changed from any thread, processing is RX thread only. Disabled by default.
+class IqCorrector
+{
+  public:
+    IqCorrector() = default;
+    IqCorrector(IqCorrector const &) = delete;
+    IqCorrector &operator=(IqCorrector const &) = delete;
+
+    // Automatic DC offset tracking (one-pole filter of block means). When turned off, the manual offset is used.
+    void set_dc_auto(bool value);
+    bool dc_auto() const;
+    void set_dc_offset(float i, float q);        // manual offset to subtract, full scale 1.0
+    void get_dc_offset(float &i, float &q) const; // current offset: estimate in automatic mode
+
+    // Automatic IQ imbalance estimation (orthogonalization of Q to I by tracked second moments).
+    // When turned off, the manual correction y = x + balance * conj(x) is used.
+    void set_iq_auto(bool value);
+    bool iq_auto() const;
+    void set_iq_balance(float re, float im);
+
+    // RX thread. `len` elements (I+Q shorts).
+    void process(short *buf, size_t len);
+
+  private:
+    void estimate(const short *buf, size_t len);
+
+    // settings, any thread
+    std::atomic<bool> _dc_auto{false};
+    std::atomic<bool> _iq_auto{false};
+    std::atomic<float> _dc_manual_i{0.0f};
+    std::atomic<float> _dc_manual_q{0.0f};
+    std::atomic<float> _balance_re{0.0f};
+    std::atomic<float> _balance_im{0.0f};
+
+    // estimates, written by RX thread. In units of samples (full scale 32768).
+    std::atomic<float> _dc_i{0.0f};
+    std::atomic<float> _dc_q{0.0f};
+    double _p_ii{0.0}; // second moments of I and Q without DC
+    double _p_qq{0.0};
+    double _p_iq{0.0};
+    bool _moments_valid{false};
+};
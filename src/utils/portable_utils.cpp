@@ -1,10 +1,16 @@
 #include "portable_utils.h"
 
+#include <stdexcept>
+
 #if defined(_WIN32)
 #include <Windows.h>
 #else
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 // from https://handsonnetworkprogramming.com/articles/socket-error-message-text/
@@ -26,3 +32,106 @@ const char *get_error_text()
 
 #endif
 }
+
+bool lock_memory(const void *addr, size_t len)
+{
+    if (len == 0)
+    {
+        return true;
+    }
+#if defined(_WIN32)
+    return VirtualLock(const_cast<void *>(addr), len) != 0;
+#else
+    return mlock(addr, len) == 0;
+#endif
+}
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(std::string const &path)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+    {
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+        throw std::runtime_error("can't open " + path);
+    }
+    _file = file;
+    _size = static_cast<size_t>(size.QuadPart);
+    if (_size == 0)
+    {
+        return; // nothing to map
+    }
+
+    _mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    _data = _mapping ? MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!_data)
+    {
+        if (_mapping)
+        {
+            CloseHandle(_mapping);
+        }
+        CloseHandle(file);
+        throw std::runtime_error("can't map " + path);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data)
+    {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping)
+    {
+        CloseHandle(_mapping);
+    }
+    CloseHandle(_file);
+}
+
+#else
+
+MappedFile::MappedFile(std::string const &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        const std::string error = strerror(errno);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        throw std::runtime_error("can't open " + path + ": " + error);
+    }
+    _size = static_cast<size_t>(st.st_size);
+    if (_size == 0)
+    {
+        close(fd);
+        return; // mmap of zero length is an error
+    }
+
+    void *addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    const std::string error = strerror(errno);
+    close(fd); // mapping keeps the file
+    if (addr == MAP_FAILED)
+    {
+        throw std::runtime_error("can't map " + path + ": " + error);
+    }
+    madvise(addr, _size, MADV_SEQUENTIAL); // read ahead, drop pages behind
+    _data = addr;
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data)
+    {
+        munmap(const_cast<void *>(_data), _size);
+    }
+}
+
+#endif
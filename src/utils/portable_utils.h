@@ -1,3 +1,37 @@
 #pragma once
 
 const char *get_error_text();
+
+#include <stddef.h>
+
+// Lock memory in RAM (mlock/VirtualLock). Returns false if not permitted, e.g. RLIMIT_MEMLOCK is too small.
+bool lock_memory(const void *addr, size_t len);
+
+#include <string>
+
+// Read-only memory mapping of a whole file (mmap/MapViewOfFile). Throws std::runtime_error if the file can't be mapped.
+class MappedFile
+{
+  public:
+    explicit MappedFile(std::string const &path);
+    ~MappedFile();
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    const void *data() const
+    {
+        return _data;
+    }
+    size_t size() const
+    {
+        return _size;
+    }
+
+  private:
+    const void *_data{nullptr};
+    size_t _size{0};
+#if defined(_WIN32)
+    void *_file{nullptr};
+    void *_mapping{nullptr};
+#endif
+};
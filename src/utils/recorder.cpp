@@ -0,0 +1,450 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "recorder.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+constexpr size_t write_block = 1024 * 1024; // bytes per write, multiple of O_DIRECT alignment
+constexpr size_t write_align = 4096;        // buffer, size and file offset alignment for O_DIRECT
+constexpr size_t staging_elements = write_block / sizeof(short);
+const std::chrono::milliseconds write_latency(100); // max time data waits in ring for a full block
+
+static int open_data_file(std::string const &path, bool &direct)
+{
+    direct = false;
+#if defined(_WIN32)
+    return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+#if defined(O_DIRECT)
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd >= 0)
+    {
+        direct = true;
+        return fd;
+    }
+    // not supported by some file systems (e.g. tmpfs), write through page cache then
+#endif
+    return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+}
+
+static bool write_all(int fd, const char *buf, size_t len)
+{
+    while (len != 0)
+    {
+#if defined(_WIN32)
+        const int res = _write(fd, buf, static_cast<unsigned int>(len));
+#else
+        const ssize_t res = ::write(fd, buf, len);
+        if (res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+#endif
+        if (res <= 0)
+        {
+            return false;
+        }
+        buf += res;
+        len -= static_cast<size_t>(res);
+    }
+    return true;
+}
+
+static void close_data_file(int fd)
+{
+#if defined(_WIN32)
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+// The last block is not aligned, it goes through page cache.
+static void clear_direct(int fd)
+{
+#if defined(O_DIRECT)
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags != -1)
+    {
+        fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+    }
+#else
+    (void)fd;
+#endif
+}
+
+// ISO 8601 UTC with nanoseconds, as SigMF core:datetime
+static std::string format_datetime(std::int64_t time_ns)
+{
+    const std::time_t seconds = static_cast<std::time_t>(time_ns / 1000000000);
+    std::tm tm_utc{};
+#if defined(_WIN32)
+    gmtime_s(&tm_utc, &seconds);
+#else
+    gmtime_r(&seconds, &tm_utc);
+#endif
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm_utc);
+    std::ostringstream ss;
+    ss << buf << '.' << std::setw(9) << std::setfill('0') << (time_ns % 1000000000) << 'Z';
+    return ss.str();
+}
+
+static std::string json_string(std::string const &s)
+{
+    std::ostringstream ss;
+    ss << '"';
+    for (const char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            ss << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        }
+        else
+        {
+            ss << c;
+        }
+    }
+    ss << '"';
+    return ss.str();
+}
+
+IqRecorder::IqRecorder(std::vector<StreamItem *> items, std::vector<std::string> bases, RecordMeta meta)
+    : _meta(std::move(meta))
+{
+    for (size_t idx = 0; idx < items.size() && idx < bases.size(); idx++)
+    {
+        ChannelFile file;
+        file.item = items[idx];
+        file.base = bases[idx];
+        _files.push_back(std::move(file));
+    }
+}
+
+IqRecorder::~IqRecorder()
+{
+    stop();
+}
+
+void IqRecorder::start()
+{
+    for (ChannelFile &file : _files)
+    {
+        const std::string path = file.base + ".sigmf-data";
+        file.fd = open_data_file(path, file.direct);
+        if (file.fd < 0)
+        {
+            const std::string error = std::strerror(errno);
+            for (ChannelFile &opened : _files)
+            {
+                if (opened.fd >= 0)
+                {
+                    close_data_file(opened.fd);
+                    opened.fd = -1;
+                }
+            }
+            throw std::runtime_error("can't create " + path + ": " + error);
+        }
+
+        file.storage.resize(write_block + write_align);
+        const std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(file.storage.data());
+        file.staging = reinterpret_cast<short *>((addr + write_align - 1) / write_align * write_align);
+        write_meta(file); // in case the recording is never stopped properly
+    }
+
+    _stop.store(false);
+    _thread = std::thread(&IqRecorder::run, this);
+}
+
+void IqRecorder::stop()
+{
+    if (!_thread.joinable())
+    {
+        return;
+    }
+    _stop.store(true);
+    _thread.join();
+}
+
+void IqRecorder::run()
+{
+    while (!_stop.load(std::memory_order_relaxed))
+    {
+        size_t total = 0;
+        for (ChannelFile &file : _files)
+        {
+            total += drain(file);
+        }
+        if (total == 0 && !_files.empty())
+        {
+            // wake up on a whole block or after write_latency, whatever comes first
+            _files[0].item->wait_for_data(write_latency, staging_elements, write_latency);
+        }
+    }
+
+    for (ChannelFile &file : _files)
+    {
+        drain(file);
+        flush(file);
+        if (file.fd >= 0)
+        {
+            close_data_file(file.fd);
+            file.fd = -1;
+        }
+        write_meta(file);
+    }
+}
+
+// Move what the ring has to staging buffer, writing full blocks. Returns number of elements taken from the ring.
+// At most one ring per call, so a producer faster than the disk can't keep the writer on one channel forever.
+size_t IqRecorder::drain(ChannelFile &file)
+{
+    size_t total = 0;
+    while (total < file.item->buffer.size())
+    {
+        short *dst = file.staging + file.staged;
+        std::uint64_t pos = 0;
+        auto copy = [dst](const short *src, size_t n) { std::memcpy(dst, src, n * sizeof(short)); };
+        const size_t n = file.item->buffer.readInPlace(staging_elements - file.staged, copy, &pos);
+        if (n == 0)
+        {
+            return total;
+        }
+
+        if (!file.started || pos != file.next_pos)
+        {
+            // start of recording or reader lost data: new capture segment from here
+            if (file.started)
+            {
+                const std::uint64_t dropped = (pos - file.next_pos) / 2; // I+Q per sample
+                file.dropped += dropped;
+                _samples_dropped.fetch_add(dropped, std::memory_order_relaxed);
+            }
+            Capture capture{};
+            capture.sample_start = file.samples;
+            capture.has_time = file.item->channel_ring->time_tags.get(pos, _meta.sample_rate, capture.time_ns);
+            capture.has_packet_number = file.item->channel_ring->time_tags.get_packet_number(pos, capture.packet_number);
+            file.captures.push_back(capture);
+            file.started = true;
+        }
+
+        file.next_pos = pos + n;
+        file.staged += n;
+        file.samples += n / 2;
+        total += n;
+        if (file.staged == staging_elements)
+        {
+            flush(file);
+        }
+    }
+    return total;
+}
+
+void IqRecorder::flush(ChannelFile &file)
+{
+    if (file.staged == 0 || file.fd < 0)
+    {
+        file.staged = 0;
+        return;
+    }
+
+    const size_t len = file.staged * sizeof(short);
+    if (file.direct && len % write_align != 0)
+    {
+        clear_direct(file.fd);
+        file.direct = false;
+    }
+
+    if (!write_all(file.fd, reinterpret_cast<const char *>(file.staging), len))
+    {
+        // disk full or similar, the rest of this channel is lost
+        _write_error.store(true, std::memory_order_relaxed);
+        close_data_file(file.fd);
+        file.fd = -1;
+    }
+    else
+    {
+        _bytes_written.fetch_add(len, std::memory_order_relaxed);
+    }
+    file.staged = 0;
+}
+
+void IqRecorder::write_meta(ChannelFile const &file) const
+{
+    std::ostringstream ss;
+    ss << std::setprecision(17);
+    ss << "{\n";
+    ss << "    \"global\": {\n";
+    ss << "        \"core:datatype\": \"ci16_le\",\n";
+    ss << "        \"core:sample_rate\": " << _meta.sample_rate << ",\n";
+    ss << "        \"core:version\": \"1.0.0\",\n";
+    ss << "        \"core:num_channels\": 1,\n";
+    ss << "        \"core:hw\": " << json_string(_meta.hw) << ",\n";
+    ss << "        \"core:recorder\": \"SoapyAfedri\",\n";
+    ss << "        \"core:extensions\": [{\"name\": \"afedri\", \"version\": \"1.0.0\", \"optional\": true}],\n";
+    ss << "        \"afedri:gains\": {";
+    bool first = true;
+    for (auto const &gain : _meta.gains)
+    {
+        ss << (first ? "" : ", ") << json_string(gain.first) << ": " << gain.second;
+        first = false;
+    }
+    ss << "},\n";
+    ss << "        \"afedri:samples_dropped\": " << file.dropped << "\n";
+    ss << "    },\n";
+    ss << "    \"captures\": [";
+    for (size_t idx = 0; idx < file.captures.size(); idx++)
+    {
+        Capture const &capture = file.captures[idx];
+        ss << (idx == 0 ? "\n" : ",\n");
+        ss << "        {\"core:sample_start\": " << capture.sample_start << ", \"core:frequency\": " << _meta.frequency;
+        if (capture.has_time)
+        {
+            ss << ", \"core:datetime\": \"" << format_datetime(capture.time_ns) << "\"";
+        }
+        if (capture.has_packet_number)
+        {
+            ss << ", \"afedri:packet_number\": " << capture.packet_number; // lines up files of different channels
+        }
+        ss << "}";
+    }
+    ss << (file.captures.empty() ? "],\n" : "\n    ],\n");
+    ss << "    \"annotations\": []\n";
+    ss << "}\n";
+
+    std::ofstream out(file.base + ".sigmf-meta", std::ios::out | std::ios::trunc);
+    out << ss.str();
+}
+
+// Position after `"key":` in `text`, npos if not found.
+static size_t find_json_value(std::string const &text, std::string const &key, size_t from = 0)
+{
+    const size_t pos = text.find("\"" + key + "\"", from);
+    if (pos == std::string::npos)
+    {
+        return std::string::npos;
+    }
+    const size_t colon = text.find(':', pos + key.size() + 2);
+    return (colon == std::string::npos) ? colon : colon + 1;
+}
+
+static bool read_json_number(std::string const &text, std::string const &key, double &value)
+{
+    const size_t pos = find_json_value(text, key);
+    if (pos == std::string::npos)
+    {
+        return false;
+    }
+    char *end = nullptr;
+    const double res = std::strtod(text.c_str() + pos, &end);
+    if (end == text.c_str() + pos)
+    {
+        return false;
+    }
+    value = res;
+    return true;
+}
+
+static bool read_json_string(std::string const &text, size_t pos, std::string &value, size_t &end)
+{
+    const size_t quote = text.find('"', pos);
+    if (quote == std::string::npos)
+    {
+        return false;
+    }
+    value.clear();
+    for (end = quote + 1; end < text.size() && text[end] != '"'; end++)
+    {
+        if (text[end] == '\\' && end + 1 < text.size())
+        {
+            end++;
+        }
+        value += text[end];
+    }
+    end++;
+    return end <= text.size();
+}
+
+bool read_record_meta(std::string const &meta_path, RecordMeta &meta, size_t &num_channels)
+{
+    std::ifstream in(meta_path);
+    if (!in)
+    {
+        return false;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string text = ss.str();
+
+    read_json_number(text, "core:sample_rate", meta.sample_rate);
+    read_json_number(text, "core:frequency", meta.frequency); // of the first capture
+
+    double channels = 1.0;
+    read_json_number(text, "core:num_channels", channels);
+    num_channels = static_cast<size_t>(channels);
+
+    size_t end = 0;
+    const size_t hw = find_json_value(text, "core:hw");
+    if (hw != std::string::npos)
+    {
+        read_json_string(text, hw, meta.hw, end);
+    }
+
+    const size_t gains = find_json_value(text, "afedri:gains");
+    const size_t gains_end = (gains == std::string::npos) ? gains : text.find('}', gains);
+    size_t pos = (gains == std::string::npos) ? gains : text.find('{', gains);
+    std::string name;
+    while (pos != std::string::npos && pos < gains_end && read_json_string(text, pos, name, end) && end < gains_end)
+    {
+        const size_t colon = text.find(':', end);
+        if (colon == std::string::npos || colon > gains_end)
+        {
+            break;
+        }
+        char *num_end = nullptr;
+        const double value = std::strtod(text.c_str() + colon + 1, &num_end);
+        meta.gains[name] = value;
+        pos = num_end - text.c_str();
+    }
+
+    // every capture object starts with core:sample_start, see write_meta()
+    const size_t captures = find_json_value(text, "captures");
+    pos = (captures == std::string::npos) ? captures : find_json_value(text, "core:sample_start", captures);
+    while (pos != std::string::npos)
+    {
+        const size_t next = find_json_value(text, "core:sample_start", pos);
+        const size_t object_end = text.find('}', pos);
+        ReplayCapture capture;
+        capture.sample_start = std::strtoull(text.c_str() + pos, nullptr, 10);
+        const size_t number = find_json_value(text, "afedri:packet_number", pos);
+        if (number != std::string::npos && number < object_end)
+        {
+            capture.has_packet_number = true;
+            capture.packet_number = std::strtoull(text.c_str() + number, nullptr, 10);
+        }
+        meta.captures.push_back(capture);
+        pos = next;
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include "udp_rx.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What is written to SigMF metadata of every channel.
+struct RecordMeta
+{
+    double sample_rate{0.0}; // rate of the channel rings
+    double frequency{0.0};
+    std::string hw{};
+    std::map<std::string, double> gains{};
+    std::vector<ReplayCapture> captures{}; // filled by read_record_meta() only
+};
+
+// Read back what IqRecorder writes to `.sigmf-meta` (also core:num_channels of interleaved recordings, 1 if absent).
+// Not a JSON parser: only the keys written by IqRecorder are looked up. Returns false if the file can't be read.
+bool read_record_meta(std::string const &meta_path, RecordMeta &meta, size_t &num_channels);
+
+// Raw CS16 recording of channel rings to SigMF files (`<base>.sigmf-data` and `<base>.sigmf-meta`), one pair per channel.
+// Own writer thread reads the rings through its own readers, so live streams never wait for the disk and never pay for a copy:
+// if the disk is too slow, only the recorder loses its oldest data, which starts a new SigMF capture segment.
+// Data goes to disk in large blocks from an aligned staging buffer, with O_DIRECT where the file system supports it.
+class IqRecorder
+{
+  public:
+    // `items` are activated readers of channel rings, one per file base name in `bases`.
+    IqRecorder(std::vector<StreamItem *> items, std::vector<std::string> bases, RecordMeta meta);
+    ~IqRecorder();
+    IqRecorder(IqRecorder const &) = delete;
+    IqRecorder &operator=(IqRecorder const &) = delete;
+
+    void start(); // open files and start writer thread. Throws std::runtime_error if a file can't be created.
+    void stop();  // write buffered data and final metadata, join writer thread
+
+    std::uint64_t bytes_written() const
+    {
+        return _bytes_written.load(std::memory_order_relaxed);
+    }
+    std::uint64_t samples_dropped() const
+    {
+        return _samples_dropped.load(std::memory_order_relaxed);
+    }
+    bool write_failed() const // a data file could not be written, recording of it was stopped
+    {
+        return _write_error.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct Capture
+    {
+        std::uint64_t sample_start;
+        bool has_time;
+        std::int64_t time_ns;
+        bool has_packet_number;
+        std::uint64_t packet_number;
+    };
+
+    struct ChannelFile
+    {
+        StreamItem *item;
+        std::string base;
+        int fd{-1};
+        bool direct{false};            // opened with O_DIRECT: only aligned blocks can be written
+        std::vector<char> storage{};   // staging buffer with room for alignment
+        short *staging{nullptr};       // aligned
+        size_t staged{0};              // elements in staging
+        std::uint64_t samples{0};      // samples written or staged
+        std::uint64_t dropped{0};      // samples lost by the reader
+        bool started{false};           // next_pos is valid
+        std::uint64_t next_pos{0};     // ring position expected next, a jump means lost data
+        std::vector<Capture> captures{};
+    };
+
+    void run();
+    size_t drain(ChannelFile &file);
+    void flush(ChannelFile &file);
+    void write_meta(ChannelFile const &file) const;
+
+    std::vector<ChannelFile> _files;
+    RecordMeta _meta;
+    std::thread _thread{};
+    std::atomic<bool> _stop{false};
+    std::atomic<bool> _write_error{false};
+    std::atomic<std::uint64_t> _bytes_written{0};
+    std::atomic<std::uint64_t> _samples_dropped{0}; // all channels
+};
@@ -0,0 +1,126 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "resampler.hpp"
+
+#include "dot_product.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+constexpr double PI = 3.14159265358979323846;
+constexpr float F_SCALE = 1.0f / 32768.0f;
+constexpr size_t block_samples = 4096; // input samples converted at once
+
+Resampler::Resampler(size_t interpolation, size_t decimation, size_t taps_per_phase)
+    : _interpolation(std::max<size_t>(interpolation, 1)), _decimation(std::max<size_t>(decimation, 1)),
+      _taps_per_phase(std::max<size_t>(taps_per_phase, 2))
+{
+    // Blackman windowed sinc at the upsampled rate, cut off at the lower of input and output Nyquist frequencies.
+    // Gain is `interpolation`, so every branch has unity gain at 0 Hz.
+    const size_t len = _taps_per_phase * _interpolation;
+    const double fc = 0.5 / static_cast<double>(std::max(_interpolation, _decimation));
+    const double center = (static_cast<double>(len) - 1.0) / 2.0;
+    std::vector<double> h(len);
+    double sum = 0.0;
+    for (size_t j = 0; j < len; j++)
+    {
+        const double x = static_cast<double>(j) - center;
+        const double sinc = (x == 0.0) ? 1.0 : std::sin(2.0 * PI * fc * x) / (2.0 * PI * fc * x);
+        const double w = 2.0 * PI * static_cast<double>(j) / static_cast<double>(len - 1);
+        h[j] = sinc * (0.42 - 0.5 * std::cos(w) + 0.08 * std::cos(2.0 * w));
+        sum += h[j];
+    }
+
+    // Branch p has taps h[p], h[p + L], h[p + 2L], ... for the newest, previous, ... input samples.
+    _taps.assign(len, 0.0f);
+    for (size_t p = 0; p < _interpolation; p++)
+    {
+        for (size_t k = 0; k < _taps_per_phase; k++)
+        {
+            _taps[p * _taps_per_phase + _taps_per_phase - 1 - k] =
+                static_cast<float>(h[p + k * _interpolation] * static_cast<double>(_interpolation) / sum);
+        }
+    }
+    _group_delay = center;
+
+    _hist_i.assign(_taps_per_phase - 1 + block_samples, 0.0f);
+    _hist_q.assign(_taps_per_phase - 1 + block_samples, 0.0f);
+}
+
+void Resampler::reset()
+{
+    std::fill(_hist_i.begin(), _hist_i.end(), 0.0f);
+    std::fill(_hist_q.begin(), _hist_q.end(), 0.0f);
+    _next_input = 0;
+    _next_phase = 0;
+}
+
+size_t Resampler::input_for(size_t num_out) const
+{
+    if (num_out == 0)
+    {
+        return 0;
+    }
+    const size_t last = _next_input * _interpolation + _next_phase + (num_out - 1) * _decimation; // upsampled time
+    return last / _interpolation + 1;
+}
+
+double Resampler::output_offset() const
+{
+    const double upsampled = static_cast<double>(_next_input * _interpolation + _next_phase) - _group_delay;
+    return upsampled / static_cast<double>(_interpolation);
+}
+
+size_t Resampler::max_output(size_t len) const
+{
+    return len / 2 * _interpolation / _decimation + 1;
+}
+
+size_t Resampler::run_block(const short *src, size_t num_samples, float *out)
+{
+    const size_t hist_len = _taps_per_phase - 1;
+    float *dst_i = &_hist_i[hist_len];
+    float *dst_q = &_hist_q[hist_len];
+    for (size_t n = 0; n < num_samples; n++)
+    {
+        dst_i[n] = static_cast<float>(src[2 * n]) * F_SCALE;
+        dst_q[n] = static_cast<float>(src[2 * n + 1]) * F_SCALE;
+    }
+
+    // Output time advances by `decimation` upsampled samples: whole input samples and a branch step.
+    const size_t input_step = _decimation / _interpolation;
+    const size_t phase_step = _decimation % _interpolation;
+    const Dot2Func dot2 = dot2_func();
+    size_t num_out = 0;
+    while (_next_input < num_samples)
+    {
+        const float *taps = &_taps[_next_phase * _taps_per_phase];
+        dot2(taps, &_hist_i[_next_input], &_hist_q[_next_input], _taps_per_phase, &out[2 * num_out], &out[2 * num_out + 1]);
+        num_out++;
+
+        _next_input += input_step;
+        _next_phase += phase_step;
+        if (_next_phase >= _interpolation)
+        {
+            _next_phase -= _interpolation;
+            _next_input++;
+        }
+    }
+    _next_input -= num_samples;
+
+    // keep the newest samples as history of the next block
+    std::memmove(_hist_i.data(), &_hist_i[num_samples], hist_len * sizeof(float));
+    std::memmove(_hist_q.data(), &_hist_q[num_samples], hist_len * sizeof(float));
+    return num_out;
+}
+
+size_t Resampler::process(const short *src, size_t len, float *out)
+{
+    size_t num_out = 0;
+    for (size_t n = 0; n < len / 2; n += block_samples)
+    {
+        num_out += run_block(src + 2 * n, std::min(block_samples, len / 2 - n), out + 2 * num_out);
+    }
+    return num_out;
+}
@@ -0,0 +1,53 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include "sample_processor.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// Rational resampler of one channel: output rate is input rate * interpolation / decimation.
+// Polyphase FIR: only the branch of every output sample is evaluated, upsampled zeros are never computed.
+// Input is CS16 I+Q, output is I+Q floats (full scale 1.0) or CS16. Not thread safe.
+class Resampler : public SampleProcessor
+{
+  public:
+    static constexpr size_t default_taps_per_phase = 32;
+
+    // `interpolation` and `decimation` should be reduced by their common divisor. The anti-aliasing low-pass filter
+    // has `taps_per_phase` taps in each of `interpolation` polyphase branches.
+    Resampler(size_t interpolation, size_t decimation, size_t taps_per_phase = default_taps_per_phase);
+
+    using SampleProcessor::process;
+    size_t process(const short *src, size_t len, float *out) override;
+
+    size_t input_for(size_t num_out) const override;
+    double output_offset() const override;
+    void reset() override;
+
+    size_t interpolation() const
+    {
+        return _interpolation;
+    }
+    size_t decimation() const
+    {
+        return _decimation;
+    }
+
+  protected:
+    size_t max_output(size_t len) const override;
+
+  private:
+    size_t run_block(const short *src, size_t num_samples, float *out);
+
+    size_t _interpolation;
+    size_t _decimation;
+    size_t _taps_per_phase;
+    double _group_delay;        // delay of the prototype filter in upsampled samples
+    std::vector<float> _taps;   // branch after branch, every branch reversed: the last tap is for the newest sample
+    std::vector<float> _hist_i; // _taps_per_phase - 1 previous samples, then samples of current block
+    std::vector<float> _hist_q;
+    size_t _next_input{0};      // newest input sample of the next output sample, relative to the next input sample
+    size_t _next_phase{0};      // branch of the next output sample, < _interpolation
+};
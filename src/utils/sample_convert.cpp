@@ -0,0 +1,166 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "sample_convert.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAMPLE_CONVERT_X86_DISPATCH 1
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SAMPLE_CONVERT_X86_SSE2_ONLY 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SAMPLE_CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Division by 32768 is exact in float, so multiplication by 1/32768 gives bit-exact result with the division.
+constexpr float F_INT16MAX = 32768.0f;
+constexpr float F_SCALE = 1.0f / F_INT16MAX;
+
+void convert_s16_to_f32_scalar(const short *src, float *dst, size_t len)
+{
+    for (size_t j = 0; j < len; j++)
+    {
+        dst[j] = (float)src[j] / F_INT16MAX;
+    }
+}
+
+#if defined(SAMPLE_CONVERT_X86_DISPATCH) || defined(SAMPLE_CONVERT_X86_SSE2_ONLY)
+
+#if defined(SAMPLE_CONVERT_X86_DISPATCH)
+__attribute__((target("sse2")))
+#endif
+static void convert_sse2(const short *src, float *dst, size_t len)
+{
+    const __m128 scale = _mm_set1_ps(F_SCALE);
+    size_t j = 0;
+    for (; j + 8 <= len; j += 8)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j));
+        // sign extend 16 -> 32 bits: place each short to the upper half, then shift arithmetically.
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst + j, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + j + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    convert_s16_to_f32_scalar(src + j, dst + j, len - j);
+}
+
+#endif
+
+#if defined(SAMPLE_CONVERT_X86_DISPATCH)
+
+__attribute__((target("avx2"))) static void convert_avx2(const short *src, float *dst, size_t len)
+{
+    const __m256 scale = _mm256_set1_ps(F_SCALE);
+    size_t j = 0;
+    for (; j + 16 <= len; j += 16)
+    {
+        const __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j)));
+        const __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j + 8)));
+        _mm256_storeu_ps(dst + j, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+        _mm256_storeu_ps(dst + j + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+    }
+    convert_s16_to_f32_scalar(src + j, dst + j, len - j);
+}
+
+__attribute__((target("avx512f"))) static void convert_avx512(const short *src, float *dst, size_t len)
+{
+    const __m512 scale = _mm512_set1_ps(F_SCALE);
+    size_t j = 0;
+    for (; j + 32 <= len; j += 32)
+    {
+        const __m512i lo = _mm512_cvtepi16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + j)));
+        const __m512i hi = _mm512_cvtepi16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + j + 16)));
+        _mm512_storeu_ps(dst + j, _mm512_mul_ps(_mm512_cvtepi32_ps(lo), scale));
+        _mm512_storeu_ps(dst + j + 16, _mm512_mul_ps(_mm512_cvtepi32_ps(hi), scale));
+    }
+    convert_s16_to_f32_scalar(src + j, dst + j, len - j);
+}
+
+#endif
+
+#if defined(SAMPLE_CONVERT_NEON)
+
+static void convert_neon(const short *src, float *dst, size_t len)
+{
+    size_t j = 0;
+    for (; j + 8 <= len; j += 8)
+    {
+        const int16x8_t v = vld1q_s16(src + j);
+        const float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+        const float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+        vst1q_f32(dst + j, vmulq_n_f32(lo, F_SCALE));
+        vst1q_f32(dst + j + 4, vmulq_n_f32(hi, F_SCALE));
+    }
+    convert_s16_to_f32_scalar(src + j, dst + j, len - j);
+}
+
+#endif
+
+typedef ConvertS16ToF32Impl ConvertImpl;
+
+static ConvertImpl select_impl()
+{
+#if defined(SAMPLE_CONVERT_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return {convert_avx512, "avx512"};
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return {convert_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return {convert_sse2, "sse2"};
+    }
+#elif defined(SAMPLE_CONVERT_X86_SSE2_ONLY)
+    return {convert_sse2, "sse2"};
+#elif defined(SAMPLE_CONVERT_NEON)
+    return {convert_neon, "neon"};
+#endif
+    return {convert_s16_to_f32_scalar, "scalar"};
+}
+
+static ConvertImpl const &get_impl()
+{
+    static const ConvertImpl impl = select_impl();
+    return impl;
+}
+
+void convert_s16_to_f32(const short *src, float *dst, size_t len)
+{
+    get_impl().func(src, dst, len);
+}
+
+const char *convert_s16_to_f32_impl_name()
+{
+    return get_impl().name;
+}
+
+std::vector<ConvertS16ToF32Impl> convert_s16_to_f32_impls()
+{
+    std::vector<ConvertS16ToF32Impl> res{{convert_s16_to_f32_scalar, "scalar"}};
+#if defined(SAMPLE_CONVERT_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+    {
+        res.push_back({convert_sse2, "sse2"});
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        res.push_back({convert_avx2, "avx2"});
+    }
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        res.push_back({convert_avx512, "avx512"});
+    }
+#elif defined(SAMPLE_CONVERT_X86_SSE2_ONLY)
+    res.push_back({convert_sse2, "sse2"});
+#elif defined(SAMPLE_CONVERT_NEON)
+    res.push_back({convert_neon, "neon"});
+#endif
+    return res;
+}
@@ -0,0 +1,25 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Convert shorts to floats: dst[i] = src[i] / 32768.0f
+// Implementation (SSE2/AVX2/AVX-512/NEON or scalar) is selected once by CPU features at runtime.
+void convert_s16_to_f32(const short *src, float *dst, size_t len);
+
+// Scalar reference implementation.
+void convert_s16_to_f32_scalar(const short *src, float *dst, size_t len);
+
+// Name of implementation selected for this CPU. For logging.
+const char *convert_s16_to_f32_impl_name();
+
+struct ConvertS16ToF32Impl
+{
+    void (*func)(const short *src, float *dst, size_t len);
+    const char *name;
+};
+
+// All implementations compiled in which this CPU can run, scalar first. For tests.
+std::vector<ConvertS16ToF32Impl> convert_s16_to_f32_impls();
@@ -0,0 +1,18 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "sample_processor.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+size_t SampleProcessor::process(const short *src, size_t len, short *out)
+{
+    _out_tmp.resize(2 * max_output(len));
+    const size_t num_out = process(src, len, _out_tmp.data());
+    for (size_t j = 0; j < 2 * num_out; j++)
+    {
+        const float v = std::min(std::max(_out_tmp[j] * 32768.0f, -32768.0f), 32767.0f);
+        out[j] = static_cast<short>(std::lrint(v));
+    }
+    return num_out;
+}
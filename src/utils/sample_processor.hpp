@@ -0,0 +1,31 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Rate changing processing of one channel between the ring and application buffers (DDC, resampler).
+// Input is CS16 I+Q, output is I+Q floats (full scale 1.0) or CS16. Not thread safe.
+class SampleProcessor
+{
+  public:
+    virtual ~SampleProcessor() = default;
+
+    // Consume `len` elements (I+Q shorts) and write complete output samples to `out`. Returns number of output samples.
+    // Input of incomplete output sample is kept, see input_for().
+    virtual size_t process(const short *src, size_t len, float *out) = 0;
+    size_t process(const short *src, size_t len, short *out);
+
+    virtual size_t input_for(size_t num_out) const = 0; // input samples needed to produce `num_out` output samples
+    // Time of the next output sample relative to the next input sample, in input samples, filter delay included.
+    // Negative when the output sample is centered on input already consumed.
+    virtual double output_offset() const = 0;
+    virtual void reset() = 0; // drop filter history
+
+  protected:
+    virtual size_t max_output(size_t len) const = 0; // output samples `len` elements of input can give at most
+
+  private:
+    std::vector<float> _out_tmp{}; // CS16 output only
+};
@@ -0,0 +1,143 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "spectrum.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr double PI = 3.14159265358979323846;
+constexpr float F_SCALE = 1.0f / 32768.0f;
+constexpr float min_power = 1e-20f; // -200 dB, instead of log of zero
+
+static double window_value(SpectrumWindow window, size_t idx, size_t len)
+{
+    const double w = 2.0 * PI * static_cast<double>(idx) / static_cast<double>(len);
+    switch (window)
+    {
+    case SpectrumWindow::Hann:
+        return 0.5 - 0.5 * std::cos(w);
+    case SpectrumWindow::BlackmanHarris:
+        return 0.35875 - 0.48829 * std::cos(w) + 0.14128 * std::cos(2.0 * w) - 0.01168 * std::cos(3.0 * w);
+    case SpectrumWindow::Rectangular:
+    default:
+        return 1.0;
+    }
+}
+
+Spectrum::Spectrum(size_t fft_size, size_t averaging, SpectrumWindow window)
+    : _fft_size(fft_size), _averaging(std::max<size_t>(averaging, 1)), _window(fft_size), _bitrev(fft_size), _tw_re(fft_size),
+      _tw_im(fft_size), _re(fft_size), _im(fft_size), _acc(fft_size, 0.0f), _frame(fft_size, 0.0f)
+{
+    double window_sum = 0.0;
+    for (size_t idx = 0; idx < _fft_size; idx++)
+    {
+        const double w = window_value(window, idx, _fft_size);
+        _window[idx] = static_cast<float>(w) * F_SCALE;
+        window_sum += w;
+    }
+    _norm = static_cast<float>(window_sum * window_sum);
+
+    size_t bits = 0;
+    while ((size_t(1) << bits) < _fft_size)
+    {
+        bits++;
+    }
+    for (size_t idx = 0; idx < _fft_size; idx++)
+    {
+        size_t rev = 0;
+        for (size_t b = 0; b < bits; b++)
+        {
+            rev |= ((idx >> b) & 1) << (bits - 1 - b);
+        }
+        _bitrev[idx] = rev;
+    }
+
+    for (size_t half = 1; half < _fft_size; half *= 2)
+    {
+        for (size_t k = 0; k < half; k++)
+        {
+            const double a = -PI * static_cast<double>(k) / static_cast<double>(half);
+            _tw_re[half - 1 + k] = static_cast<float>(std::cos(a));
+            _tw_im[half - 1 + k] = static_cast<float>(std::sin(a));
+        }
+    }
+}
+
+size_t Spectrum::input_for_frame() const
+{
+    return 2 * ((_averaging - _transforms) * _fft_size - _filled); // I+Q per sample
+}
+
+void Spectrum::reset()
+{
+    _filled = 0;
+    _transforms = 0;
+    std::fill(_acc.begin(), _acc.end(), 0.0f);
+}
+
+// Iterative radix-2 decimation in time. The inner loop runs over contiguous butterflies and twiddles,
+// so it is vectorized by compiler for all stages except the first three.
+void Spectrum::transform()
+{
+    float *re = _re.data();
+    float *im = _im.data();
+    for (size_t half = 1; half < _fft_size; half *= 2)
+    {
+        const float *wr = &_tw_re[half - 1];
+        const float *wi = &_tw_im[half - 1];
+        for (size_t start = 0; start < _fft_size; start += 2 * half)
+        {
+            float *re_a = re + start;
+            float *im_a = im + start;
+            float *re_b = re + start + half;
+            float *im_b = im + start + half;
+            for (size_t k = 0; k < half; k++)
+            {
+                const float tr = re_b[k] * wr[k] - im_b[k] * wi[k];
+                const float ti = re_b[k] * wi[k] + im_b[k] * wr[k];
+                re_b[k] = re_a[k] - tr;
+                im_b[k] = im_a[k] - ti;
+                re_a[k] += tr;
+                im_a[k] += ti;
+            }
+        }
+    }
+
+    for (size_t idx = 0; idx < _fft_size; idx++)
+    {
+        _acc[idx] += re[idx] * re[idx] + im[idx] * im[idx];
+    }
+}
+
+bool Spectrum::feed(const short *src, size_t len)
+{
+    for (size_t n = 0; n < len / 2; n++)
+    {
+        // window, scale and bit reversed order in one pass
+        const size_t pos = _bitrev[_filled];
+        _re[pos] = static_cast<float>(src[2 * n]) * _window[_filled];
+        _im[pos] = static_cast<float>(src[2 * n + 1]) * _window[_filled];
+        if (++_filled < _fft_size)
+        {
+            continue;
+        }
+
+        _filled = 0;
+        transform();
+        if (++_transforms < _averaging)
+        {
+            continue;
+        }
+
+        // average, dB, 0 Hz to the middle
+        const float scale = 1.0f / (_norm * static_cast<float>(_averaging));
+        const size_t half = _fft_size / 2;
+        for (size_t idx = 0; idx < _fft_size; idx++)
+        {
+            _frame[(idx + half) % _fft_size] = 10.0f * std::log10(std::max(_acc[idx] * scale, min_power));
+        }
+        reset();
+        return true;
+    }
+    return false;
+}
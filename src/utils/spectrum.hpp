@@ -0,0 +1,53 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+enum class SpectrumWindow
+{
+    Rectangular = 0,
+    Hann = 1,
+    BlackmanHarris = 2,
+};
+
+// Averaged power spectrum of CS16 I+Q samples of one channel: window, FFT, |X|^2 averaged over `averaging` transforms.
+// Frame is in dB relative to full scale sine, 0 Hz in the middle. Not thread safe.
+class Spectrum
+{
+  public:
+    // `fft_size` must be a power of 2.
+    Spectrum(size_t fft_size, size_t averaging, SpectrumWindow window);
+
+    size_t input_for_frame() const; // elements (I+Q shorts) still needed to complete the current frame
+    // Consume up to input_for_frame() elements. Returns true when the frame is completed, next call starts a new one.
+    bool feed(const short *src, size_t len);
+    void reset(); // drop incomplete frame
+
+    std::vector<float> const &frame() const // the last completed frame
+    {
+        return _frame;
+    }
+    size_t fft_size() const
+    {
+        return _fft_size;
+    }
+
+  private:
+    void transform();
+
+    size_t _fft_size;
+    size_t _averaging;
+    std::vector<float> _window;  // with 1/32768 scale of input
+    std::vector<size_t> _bitrev; // input index -> position in bit reversed order
+    std::vector<float> _tw_re;   // twiddles of every stage one after another: stage with half size h starts at h - 1
+    std::vector<float> _tw_im;
+    std::vector<float> _re;      // transform in place, split complex layout for vectorized butterflies
+    std::vector<float> _im;
+    std::vector<float> _acc;     // sum of |X|^2 of transforms of the frame
+    size_t _filled{0};           // samples of current transform
+    size_t _transforms{0};       // transforms done for current frame
+    float _norm;                 // power of full scale sine at its bin
+    std::vector<float> _frame;
+};
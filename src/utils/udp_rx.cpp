@@ -2,13 +2,27 @@
 //  SPDX-License-Identifier: GPL-3.0-or-later
 #include "udp_rx.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <map>
 #include <sstream>
 #include <thread>
 #include <vector>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#include "deinterleave.hpp"
 #include "inet_common.h"
 #include "portable_utils.h"
+#include "uring_recv.hpp"
 
 constexpr size_t num_data_bytes_in_block = 1024;
 constexpr size_t num_bytes_expected = num_data_bytes_in_block + 4; // 1028
@@ -17,158 +31,1296 @@ constexpr size_t max_num_elements_in_block = num_data_bytes_in_block / 2; // I/Q
 
 // one element is I or Q (2 bytes)
 
-static void net_recv_operation(std::shared_ptr<UdpRxContext> ctx)
+// Wait until socket has data to read.
+// Returns: 1 - data available, 0 - timeout, -1 - thread must exit.
+static int wait_for_data(UdpRxContext &ctx)
+{
+    int sock = ctx.sock;
+    // check for invalid socket
+    if (sock == -1)
+    {
+        return -1;
+    }
+
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    FD_SET(sock, &readfds);
+
+    struct timeval tv = {0, 200000}; // 0.2 seconds delay
+    int ret = select(sock + 1, &readfds, NULL, NULL, &tv);
+
+    // check for force stop condition
+    if (ctx.flag_stop)
+    {
+        return -1;
+    }
+
+    // check for invalid socket
+    if (ctx.sock == -1)
+    {
+        return -1;
+    }
+
+    return (ret == 0) ? 0 : 1;
+}
+
+static void log_unexpected_size(UdpRxContext &ctx, int bytes_did_read)
+{
+    if (ctx.log_debug_print)
+    {
+        std::ostringstream ss;
+        ss << "Num bytes expected=" << num_bytes_expected << ", num bytes read=" << bytes_did_read;
+        ctx.log_debug_print(ss.str());
+    }
+}
+
+static std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+#if defined(__linux__)
+// space for SCM_TIMESTAMPNS and SO_RXQ_OVFL control messages
+constexpr size_t rx_control_len = CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(std::uint32_t));
+
+// Kernel receive time of datagram (SO_TIMESTAMPNS), or current time if kernel didn't provide it.
+// Also updates kernel drop counter (SO_RXQ_OVFL).
+static std::int64_t get_rx_time_ns(UdpRxContext &ctx, struct msghdr &msg)
+{
+    std::int64_t res = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            res = static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        }
+        else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            std::uint32_t drops;
+            std::memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            ctx.kernel_drops.store(drops, std::memory_order_relaxed); // kernel gives total since socket creation
+        }
+    }
+    return (res != 0) ? res : now_ns();
+}
+#endif
+
+// Check packet counter in UDP packet header (bytes 2,3 little endian). Returns number of packets lost before this one.
+static size_t track_packet_sequence(UdpRxContext &ctx, const unsigned char *packet)
+{
+    const std::uint16_t seq = static_cast<std::uint16_t>(packet[2] | (packet[3] << 8));
+    const std::uint16_t last = ctx.last_packet_seq;
+    const bool was_valid = ctx.packet_seq_valid;
+
+    ctx.last_packet_seq = seq;
+    ctx.packet_seq_valid = true;
+
+    if (!was_valid)
+    {
+        return 0;
+    }
+
+    const std::uint16_t diff = static_cast<std::uint16_t>(seq - last);
+    if (diff == 1 || (last == 0xFFFF && seq == 1) || diff == 0)
+    {
+        // in order (counter may skip zero on wrap), or duplicate
+        return 0;
+    }
+
+    const size_t lost = static_cast<size_t>(diff - 1);
+    ctx.packets_lost.fetch_add(lost, std::memory_order_relaxed);
+    return lost;
+}
+
+// Let every active stream know that continuity is broken.
+static void mark_data_lost(UdpRxContext &ctx)
+{
+    for (auto &channel : ctx.channels)
+    {
+        for (auto &stream : channel)
+        {
+            if (stream.unique_stream_id)
+            {
+                stream.data_lost.store(true, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// Put `num_elements` with time tags of `num_packets` packets to `ring`.
+static void put_to_ring(UdpRxContext const &ctx, ChannelRing &ring, const short *buf, size_t num_elements, const std::int64_t *packet_times,
+                        size_t num_packets)
+{
+    const size_t slot_len = num_elements / num_packets;
+    const std::uint64_t pos = ring.ring.writePosition();
+    for (size_t idx = 0; idx < num_packets; idx++)
+    {
+        ring.time_tags.set(pos + idx * slot_len, packet_times[idx], ctx.packet_number + idx);
+    }
+    ring.ring.put(buf, num_elements);
+}
+
+// Transfer `num_elements` from each of channel's buffers to the channel ring, then notify readers.
+// Data consists of `num_packets` packets with receive times `packet_times`.
+// Data is copied once per channel, no matter how many streams read it; once more for every stream with a ring of its own.
+// The channel ring is always written: no reader can hold back data of the others.
+static void push_to_streams(UdpRxContext &ctx, short *const *arr_buf, size_t num_elements, const std::int64_t *packet_times,
+                            size_t num_packets)
+{
+    const size_t num_of_channels = ctx.channels.size();
+
+    for (size_t channel = 0; channel < num_of_channels; channel++)
+    {
+        auto &streams = ctx.channels[channel];
+        ChannelRing &ring = ctx.rings[channel];
+
+        bool any_reader = false;
+        bool any_shared = false;
+        for (auto &stream : streams)
+        {
+            if (stream.unique_stream_id && stream.begin_produce())
+            {
+                any_reader = true;
+                any_shared = any_shared || stream.channel_ring == &ring;
+            }
+        }
+
+        if (!any_reader)
+        {
+            continue;
+        }
+
+        ring.correction.process(arr_buf[channel], num_elements);
+
+        if (any_shared)
+        {
+            // lagging readers lose their oldest data
+            for (auto &stream : streams)
+            {
+                if (stream.is_producing() && stream.channel_ring == &ring)
+                {
+                    stream.buffer.prepare_put(num_elements);
+                    stream.buffer.make_room(num_elements);
+                }
+            }
+            put_to_ring(ctx, ring, arr_buf[channel], num_elements, packet_times, num_packets);
+        }
+
+        for (auto &stream : streams)
+        {
+            if (!stream.is_producing())
+            {
+                continue;
+            }
+            if (stream.channel_ring != &ring)
+            {
+                // own ring: the stream decides alone whether it takes data
+                if (stream.buffer.prepare_put(num_elements))
+                {
+                    stream.buffer.make_room(num_elements);
+                    put_to_ring(ctx, *stream.channel_ring, arr_buf[channel], num_elements, packet_times, num_packets);
+                }
+                else
+                {
+                    stream.buffer.drop_put(num_elements);
+                }
+            }
+            stream.buffer.end_put();
+            stream.end_produce();
+        }
+    }
+
+    ctx.packet_number += num_packets; // same numbers in every channel, even if some of them dropped the data
+
+    // Notify them all.
+    for (size_t channel = 0; channel < num_of_channels; channel++)
+    {
+        for (auto &stream : ctx.channels[channel])
+        {
+            if (stream.unique_stream_id)
+            {
+                stream.notify();
+            }
+        }
+    }
+}
+
+// Lock buffer of RX thread in memory if asked by options. Vectors are already prefaulted by zero fill.
+template <class T> static void lock_rx_buffer(UdpRxContext const &ctx, std::vector<T> const &buf)
+{
+    if (ctx.options.lock_memory && !lock_memory(buf.data(), buf.size() * sizeof(T)) && ctx.log_debug_print)
+    {
+        ctx.log_debug_print(std::string("Can't lock RX buffer in memory: ") + get_error_text());
+    }
+}
+
+// Per channel buffers for deinterleaved data of up to `num_packets` UDP packets.
+struct ChannelBuffers
+{
+    ChannelBuffers(UdpRxContext const &ctx, size_t num_packets)
+    {
+        for (size_t channel = 0; channel < 4; channel++)
+        {
+            bufs[channel].resize(max_num_elements_in_block * num_packets);
+            arr_buf[channel] = bufs[channel].data();
+            lock_rx_buffer(ctx, bufs[channel]);
+        }
+    }
+
+    std::vector<short> bufs[4];
+    short *arr_buf[4]; // to access by index
+};
+
+static void net_recv_operation_select(std::shared_ptr<UdpRxContext> ctx)
 {
     struct sockaddr_in client_addr;
     std::vector<unsigned char> rx_buf(num_bytes_expected);
 
+#if defined(__linux__)
+    std::vector<unsigned char> control(rx_control_len);
+    struct iovec iov;
+    iov.iov_base = &rx_buf[0];
+    iov.iov_len = rx_buf.size();
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &client_addr;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    lock_rx_buffer(*ctx, control);
+#endif
+    lock_rx_buffer(*ctx, rx_buf);
+
     // result buffers
-    std::vector<short> buf0(max_num_elements_in_block);
-    std::vector<short> buf1(max_num_elements_in_block);
-    std::vector<short> buf2(max_num_elements_in_block);
-    std::vector<short> buf3(max_num_elements_in_block);
+    ChannelBuffers result(*ctx, 1);
+
+    // deinterleaver specialized for number of channels
+    const DeinterleaveFunc deinterleave = select_deinterleaver(ctx->channels.size());
+
+    for (;;)
+    {
+        std::memset(&client_addr, 0, sizeof(client_addr));
+        socklen_t client_addr_len = sizeof(client_addr);
+
+        int ret = wait_for_data(*ctx);
+        if (ret < 0)
+        {
+            break;
+        }
+
+        // check for timeout
+        if (ret == 0)
+        {
+            continue;
+        }
+
+        // Read data. The call must be nonblocked because select told us we can read data.
+#if defined(__linux__)
+        msg.msg_namelen = client_addr_len;
+        msg.msg_controllen = control.size();
+        int bytes_did_read = (int)recvmsg(ctx->sock, &msg, 0);
+        const std::int64_t rx_time = get_rx_time_ns(*ctx, msg);
+#else
+        int bytes_did_read =
+            recvfrom(ctx->sock, (char *)&rx_buf[0], (int)rx_buf.size(), 0, (struct sockaddr *)&client_addr, &client_addr_len);
+        const std::int64_t rx_time = now_ns();
+#endif
+        if (bytes_did_read < 0)
+        {
+            if (ctx->log_debug_print)
+            {
+                ctx->log_debug_print("reading error...");
+            }
+            break;
+        }
+
+        // check for force stop condition again
+        if (ctx->flag_stop)
+        {
+            break;
+        }
+
+        if (bytes_did_read != num_bytes_expected)
+        {
+            log_unexpected_size(*ctx, bytes_did_read);
+            continue;
+        }
+
+        if (!ctx->rx_active)
+        {
+            // no need to do data processing (dummy read)
+            ctx->packet_seq_valid = false;
+            continue;
+        }
+
+        if (track_packet_sequence(*ctx, &rx_buf[0]) != 0)
+        {
+            mark_data_lost(*ctx);
+        }
+
+        const short *buf = (const short *)&rx_buf[4]; // skip 4 bytes (marker and packet count)
+
+        // pos - number of elements in each result buffer
+        size_t pos = deinterleave(buf, max_num_elements_in_block, result.arr_buf, 0);
+
+        push_to_streams(*ctx, result.arr_buf, pos, &rx_time, 1);
+    }
+}
+
+#if defined(__linux__)
+// recvmmsg state of one socket: datagram buffers, control messages and deinterleaved result.
+// Used by the RX thread of recvmmsg engine and by reactor threads.
+class MmsgReceiver
+{
+  public:
+    explicit MmsgReceiver(UdpRxContext const &ctx)
+        : _batch_size(ctx.options.batch_size), _rx_buf(num_bytes_expected * _batch_size), _iovecs(_batch_size), _msgs(_batch_size),
+          _control(rx_control_len * _batch_size), _packet_times(_batch_size), _result(ctx, _batch_size),
+          _deinterleave(select_deinterleaver(ctx.channels.size()))
+    {
+        lock_rx_buffer(ctx, _rx_buf);
+        lock_rx_buffer(ctx, _control);
+        lock_rx_buffer(ctx, _packet_times);
+
+        for (size_t i = 0; i < _batch_size; i++)
+        {
+            _iovecs[i].iov_base = &_rx_buf[i * num_bytes_expected];
+            _iovecs[i].iov_len = num_bytes_expected;
+            std::memset(&_msgs[i], 0, sizeof(_msgs[i]));
+            _msgs[i].msg_hdr.msg_iov = &_iovecs[i];
+            _msgs[i].msg_hdr.msg_iovlen = 1;
+            _msgs[i].msg_hdr.msg_control = &_control[i * rx_control_len];
+        }
+    }
+
+    size_t batch_size() const
+    {
+        return _batch_size;
+    }
+
+    // Drain up to batch_size datagrams by one call and push them to streams. Never blocks.
+    // Returns number of datagrams got (0 - socket queue is empty) or -1 if receiving must stop.
+    int receive(UdpRxContext &ctx);
+
+  private:
+    size_t _batch_size;
+    std::vector<unsigned char> _rx_buf;
+    std::vector<struct iovec> _iovecs;
+    std::vector<struct mmsghdr> _msgs;
+    std::vector<unsigned char> _control;
+    std::vector<std::int64_t> _packet_times; // receive time of every accepted datagram
+    ChannelBuffers _result;                  // large enough for the whole batch
+    DeinterleaveFunc _deinterleave;          // specialized for number of channels
+};
+
+int MmsgReceiver::receive(UdpRxContext &ctx)
+{
+    // kernel shrinks it to actual length on every call
+    for (size_t i = 0; i < _batch_size; i++)
+    {
+        _msgs[i].msg_hdr.msg_controllen = rx_control_len;
+    }
+
+    int num_msgs = recvmmsg(ctx.sock, _msgs.data(), (unsigned int)_batch_size, MSG_DONTWAIT, nullptr);
+    if (num_msgs < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            return 0;
+        }
+
+        if (ctx.log_debug_print)
+        {
+            ctx.log_debug_print("reading error...");
+        }
+        return -1;
+    }
+
+    // check for force stop condition again
+    if (ctx.flag_stop)
+    {
+        return -1;
+    }
+
+    if (!ctx.rx_active)
+    {
+        // no need to do data processing (dummy read)
+        ctx.packet_seq_valid = false;
+        return num_msgs;
+    }
+
+    // deinterleave all datagrams of the batch, then push them to streams in one pass
+    size_t pos = 0;
+    size_t lost = 0;
+    size_t num_packets = 0;
+    for (int i = 0; i < num_msgs; i++)
+    {
+        if (_msgs[i].msg_len != num_bytes_expected)
+        {
+            log_unexpected_size(ctx, (int)_msgs[i].msg_len);
+            continue;
+        }
+
+        lost += track_packet_sequence(ctx, &_rx_buf[i * num_bytes_expected]);
+        _packet_times[num_packets++] = get_rx_time_ns(ctx, _msgs[i].msg_hdr);
+
+        const short *buf = (const short *)&_rx_buf[i * num_bytes_expected + 4]; // skip 4 bytes (marker and packet count)
+        pos = _deinterleave(buf, max_num_elements_in_block, _result.arr_buf, pos);
+    }
+
+    if (lost != 0)
+    {
+        mark_data_lost(ctx);
+    }
+
+    if (num_packets != 0)
+    {
+        push_to_streams(ctx, _result.arr_buf, pos, _packet_times.data(), num_packets);
+    }
+
+    return num_msgs;
+}
+
+static void net_recv_operation_mmsg(std::shared_ptr<UdpRxContext> ctx)
+{
+    MmsgReceiver receiver(*ctx);
+
+    bool queue_drained = true; // last recvmmsg got less than batch_size datagrams, so we have to wait for new ones
+
+    for (;;)
+    {
+        if (queue_drained)
+        {
+            int ret = wait_for_data(*ctx);
+            if (ret < 0)
+            {
+                break;
+            }
+
+            // check for timeout
+            if (ret == 0)
+            {
+                continue;
+            }
+        }
+
+        int num_msgs = receiver.receive(*ctx);
+        if (num_msgs < 0)
+        {
+            break;
+        }
+
+        queue_drained = static_cast<size_t>(num_msgs) < receiver.batch_size();
+    }
+}
+#endif
+
+#if defined(AFEDRI_IO_URING)
+// io_uring engine: datagrams land in provided buffers by one multishot request, no syscall per packet.
+// Returns false if io_uring can't be used, then caller falls back to recvmmsg.
+static bool net_recv_operation_uring(std::shared_ptr<UdpRxContext> ctx)
+{
+    const size_t batch_size = ctx->options.batch_size;
+
+    std::unique_ptr<UringRecv> uring;
+    try
+    {
+        // enough buffers for several batches, so kernel doesn't stop the request while we process completions
+        uring.reset(new UringRecv(ctx->sock, batch_size * 8, num_bytes_expected, rx_control_len, ctx->options.lock_memory));
+    }
+    catch (UringRecvError const &e)
+    {
+        if (ctx->log_debug_print)
+        {
+            ctx->log_debug_print(std::string("io_uring is not available (") + e.what() + "), recvmmsg engine will be used.");
+        }
+        return false;
+    }
+
+    if (ctx->options.lock_memory && !uring->buffers_locked() && ctx->log_debug_print)
+    {
+        ctx->log_debug_print("Can't lock io_uring buffers in memory");
+    }
+
+    std::vector<std::int64_t> packet_times(batch_size); // receive time of every accepted datagram
+    ChannelBuffers result(*ctx, batch_size);             // deinterleaved data of up to batch_size datagrams
+    lock_rx_buffer(*ctx, packet_times);
+    const DeinterleaveFunc deinterleave = select_deinterleaver(ctx->channels.size());
+
+    size_t pos = 0;
+    size_t lost = 0;
+    size_t num_packets = 0;
+    auto flush = [&]() {
+        if (lost != 0)
+        {
+            mark_data_lost(*ctx);
+        }
+        if (num_packets != 0)
+        {
+            push_to_streams(*ctx, result.arr_buf, pos, packet_times.data(), num_packets);
+        }
+        pos = 0;
+        lost = 0;
+        num_packets = 0;
+    };
+
+    bool got_datagram = false;
+    for (;;)
+    {
+        int ret = uring->wait(200); // 0.2 seconds delay to check for stop
+        if (ret < 0)
+        {
+            if (ctx->log_debug_print)
+            {
+                ctx->log_debug_print(std::string("io_uring error: ") + std::strerror(-ret));
+            }
+            break;
+        }
+
+        // check for force stop condition
+        if (ctx->flag_stop || ctx->sock == -1)
+        {
+            break;
+        }
+
+        UringRecv::Datagram dgram;
+        while ((ret = uring->next(dgram)) > 0)
+        {
+            got_datagram = true;
+
+            if (!ctx->rx_active)
+            {
+                // no need to do data processing (dummy read)
+                ctx->packet_seq_valid = false;
+                continue;
+            }
+
+            if (dgram.len != num_bytes_expected)
+            {
+                log_unexpected_size(*ctx, (int)dgram.len);
+                continue;
+            }
+
+            lost += track_packet_sequence(*ctx, dgram.payload);
+            packet_times[num_packets++] = get_rx_time_ns(*ctx, dgram.msg);
+
+            const short *buf = (const short *)(dgram.payload + 4); // skip 4 bytes (marker and packet count)
+            pos = deinterleave(buf, max_num_elements_in_block, result.arr_buf, pos);
+
+            if (num_packets == batch_size)
+            {
+                flush();
+            }
+        }
+        flush();
+
+        if (ret < 0)
+        {
+            // kernel without multishot recvmsg rejects the very first request
+            if (!got_datagram && (ret == -EINVAL || ret == -EOPNOTSUPP))
+            {
+                if (ctx->log_debug_print)
+                {
+                    ctx->log_debug_print("io_uring multishot receive is not supported, recvmmsg engine will be used.");
+                }
+                return false;
+            }
+
+            if (ctx->log_debug_print)
+            {
+                ctx->log_debug_print(std::string("io_uring receive error: ") + std::strerror(-ret));
+            }
+            break;
+        }
+    }
+
+    return true;
+}
+#endif
+
+// Name, CPU affinity and scheduling of RX thread. Called from the thread itself. Failures are not fatal.
+static void setup_rx_thread(UdpRxOptions const &options, std::string const &name, void (*log_debug_print)(std::string const &))
+{
+#if defined(__linux__)
+    pthread_setname_np(pthread_self(), name.c_str());
+
+    if (!options.cpus.empty())
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (int cpu : options.cpus)
+        {
+            CPU_SET(cpu, &cpuset);
+        }
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+        if (ret != 0 && log_debug_print)
+        {
+            log_debug_print(std::string("Can't set RX thread CPU affinity: ") + std::strerror(ret));
+        }
+    }
+
+    if (options.sched != UdpRxSched::Default)
+    {
+        const int policy = (options.sched == UdpRxSched::Fifo) ? SCHED_FIFO : SCHED_RR;
+        struct sched_param param;
+        std::memset(&param, 0, sizeof(param));
+        param.sched_priority = options.sched_priority;
+        int ret = pthread_setschedparam(pthread_self(), policy, &param);
+        if (ret != 0 && log_debug_print)
+        {
+            // usually EPERM - no CAP_SYS_NICE or RLIMIT_RTPRIO, continue with default scheduling
+            log_debug_print(std::string("Can't set RX thread real-time priority, default scheduling is used: ") + std::strerror(ret));
+        }
+    }
+#else
+    if ((!options.cpus.empty() || options.sched != UdpRxSched::Default) && log_debug_print)
+    {
+        log_debug_print("RX thread CPU affinity and priority are supported on Linux only.");
+    }
+#endif
+}
+
+static void net_recv_operation(std::shared_ptr<UdpRxContext> ctx)
+{
+    setup_rx_thread(ctx->options, ctx->thread_name, ctx->log_debug_print);
+
+#if defined(__linux__)
+#if defined(AFEDRI_IO_URING)
+    if (ctx->options.engine == UdpRxEngine::IoUring && !net_recv_operation_uring(ctx))
+    {
+        ctx->options.engine = UdpRxEngine::RecvMmsg;
+    }
+#endif
+    if (ctx->options.engine == UdpRxEngine::RecvMmsg)
+    {
+        net_recv_operation_mmsg(ctx);
+    }
+    else
+    {
+        net_recv_operation_select(ctx);
+    }
+#else
+    net_recv_operation_select(ctx);
+#endif
+
+    if (ctx->sock != -1)
+    {
+        closesocket(ctx->sock);
+        ctx->sock = -1;
+    }
+    ctx->wake_readers();
+
+    if (ctx->log_debug_print)
+    {
+        ctx->log_debug_print("Exit RX thread");
+    }
+}
+
+// RX thread of replay context. Payload of device packets is taken from the mapped file and goes the same way as received one:
+// deinterleaver, correction, channel rings. Channel files give payload of every channel already apart, packet by packet
+// of the runs. Packet times are the file timeline from the moment streaming started.
+static void replay_operation(std::shared_ptr<UdpRxContext> ctx)
+{
+    setup_rx_thread(ctx->options, ctx->thread_name, ctx->log_debug_print);
+
+    std::vector<const short *> file_data;
+    for (auto const &file : ctx->replay_files)
+    {
+        file_data.push_back(static_cast<const short *>(file->data()));
+    }
+    const std::vector<ReplayRun> &runs = ctx->replay_runs;
+    const bool channel_files = !ctx->replay.channel_files.empty();
+    size_t num_blocks = ctx->replay_files[0]->size() / num_data_bytes_in_block; // tail shorter than a packet is ignored
+    if (channel_files)
+    {
+        num_blocks = 0;
+        for (ReplayRun const &run : runs)
+        {
+            num_blocks += static_cast<size_t>(run.num_packets);
+        }
+    }
+    const size_t slot_len = ctx->elements_per_packet();
+    const size_t samples_per_block = slot_len / 2;
+    const size_t batch_size = ctx->options.batch_size;
+
+    ChannelBuffers result(*ctx, batch_size);
+    std::vector<std::int64_t> packet_times(batch_size);
+    const DeinterleaveFunc deinterleave = select_deinterleaver(ctx->channels.size());
+
+    size_t next_block = 0;
+    size_t run_idx = 0;          // channel files: run of next_block
+    std::uint64_t run_block = 0; // channel files: next_block within the run
+    bool started = false;        // timeline below is valid
+    double rate = 0.0;
+    std::chrono::steady_clock::time_point start_time{};
+    std::int64_t start_ns = 0;
+    std::uint64_t blocks_since_start = 0;
+    while (!ctx->flag_stop)
+    {
+        const bool end_of_file = next_block == num_blocks && (!ctx->replay.loop || num_blocks == 0);
+        if (!ctx->rx_active || end_of_file)
+        {
+            started = false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        if (next_block == num_blocks)
+        {
+            next_block = 0;
+            run_idx = 0;
+            run_block = 0;
+        }
+
+        const double current_rate = ctx->replay_rate.load(std::memory_order_relaxed);
+        if (!started || current_rate != rate)
+        {
+            // new timeline from now on
+            rate = current_rate;
+            start_time = std::chrono::steady_clock::now();
+            start_ns = now_ns();
+            blocks_since_start = 0;
+            started = true;
+        }
+
+        const size_t num_packets = std::min(batch_size, num_blocks - next_block);
+        if (ctx->replay.paced && rate > 0.0)
+        {
+            const double seconds = static_cast<double>(blocks_since_start * samples_per_block) / rate;
+            std::this_thread::sleep_until(start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                           std::chrono::duration<double>(seconds)));
+        }
+
+        size_t pos = 0;
+        for (size_t idx = 0; idx < num_packets; idx++)
+        {
+            if (channel_files)
+            {
+                while (run_block == runs[run_idx].num_packets)
+                {
+                    run_idx++;
+                    run_block = 0;
+                }
+                for (size_t channel = 0; channel < file_data.size(); channel++)
+                {
+                    const short *src = file_data[channel] + runs[run_idx].offsets[channel] + run_block * slot_len;
+                    std::memcpy(result.arr_buf[channel] + pos, src, slot_len * sizeof(short));
+                }
+                pos += slot_len;
+                run_block++;
+            }
+            else
+            {
+                pos = deinterleave(file_data[0] + (next_block + idx) * max_num_elements_in_block, max_num_elements_in_block,
+                                   result.arr_buf, pos);
+            }
+            const double samples = static_cast<double>((blocks_since_start + idx) * samples_per_block);
+            packet_times[idx] = (rate > 0.0) ? start_ns + static_cast<std::int64_t>(samples * 1e9 / rate) : now_ns();
+        }
+
+        push_to_streams(*ctx, result.arr_buf, pos, packet_times.data(), num_packets);
+        next_block += num_packets;
+        blocks_since_start += num_packets;
+    }
+
+    if (ctx->log_debug_print)
+    {
+        ctx->log_debug_print("Exit replay thread");
+    }
+}
+
+#if defined(__linux__)
+// Process-wide receive reactor for rx_engine=reactor. A small pool of threads serves sockets of all devices:
+// every socket is assigned to the least loaded thread, which waits on its epoll instance and receives with recvmmsg.
+// Sockets are level triggered and get one batch per wake-up, so a busy device can't starve others on the same thread.
+class UdpRxReactor
+{
+  public:
+    // The reactor exists while at least one device uses it. Options of the device which created it set
+    // number of threads, their CPU affinity and priority.
+    static std::shared_ptr<UdpRxReactor> instance(UdpRxOptions const &options, void (*log_debug_print)(std::string const &));
 
-    // to access by index
-    short *arr_buf[4] = {buf0.data(), buf1.data(), buf2.data(), buf3.data()};
+    UdpRxReactor(UdpRxOptions const &options, void (*log_debug_print)(std::string const &));
+    ~UdpRxReactor();
+    UdpRxReactor(UdpRxReactor &) = delete;
+    UdpRxReactor &operator=(UdpRxReactor const &) = delete;
+
+    void add(UdpRxContext &ctx);
+    void remove(UdpRxContext &ctx); // after return no reactor thread touches ctx
+
+  private:
+    struct Registration
+    {
+        UdpRxContext *ctx;
+        std::unique_ptr<MmsgReceiver> receiver;
+    };
+
+    struct Worker
+    {
+        int epoll_fd{-1};
+        std::mutex mtx{};               // protects registrations and busy, not held while receiving
+        std::condition_variable idle{}; // signaled when busy is cleared
+        std::map<std::uint64_t, std::shared_ptr<Registration>> registrations{};
+        UdpRxContext const *busy{nullptr}; // context the thread serves now without mtx, remove() waits for it
+        size_t load{0};                    // number of sockets, protected by _mtx
+        std::thread thr{};
+    };
+
+    void run(Worker &worker, size_t index);
+
+    UdpRxOptions _options;
+    void (*_log_debug_print)(std::string const &);
+    int _wake_fd{-1};               // eventfd, signaled to stop all threads
+    std::atomic<bool> _stop{false}; // set before _wake_fd is signaled
+    std::deque<Worker> _workers{};  // deque because Worker holds mutex
+    std::mutex _mtx{};              // protects _sockets and worker load
+    std::uint64_t _next_id{1};      // 0 is used by _wake_fd
+    std::map<UdpRxContext *, std::pair<Worker *, std::uint64_t>> _sockets{};
+};
+
+std::shared_ptr<UdpRxReactor> UdpRxReactor::instance(UdpRxOptions const &options, void (*log_debug_print)(std::string const &))
+{
+    static std::mutex mtx;
+    static std::weak_ptr<UdpRxReactor> current;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    auto res = current.lock();
+    if (!res)
+    {
+        res = std::make_shared<UdpRxReactor>(options, log_debug_print);
+        current = res;
+    }
+    else if (res->_options.reactor_threads != options.reactor_threads && log_debug_print)
+    {
+        log_debug_print("RX reactor is already running with " + std::to_string(res->_options.reactor_threads) + " thread(s).");
+    }
+    return res;
+}
+
+UdpRxReactor::UdpRxReactor(UdpRxOptions const &options, void (*log_debug_print)(std::string const &))
+    : _options(options), _log_debug_print(log_debug_print)
+{
+    const size_t num_threads = std::max<size_t>(1, _options.reactor_threads);
+
+    _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_wake_fd < 0)
+    {
+        throw UdpRxError(std::string("eventfd error: ") + std::strerror(errno));
+    }
+
+    for (size_t idx = 0; idx < num_threads; idx++)
+    {
+        _workers.emplace_back();
+        Worker &worker = _workers.back();
+        worker.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        struct epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0;
+        if (worker.epoll_fd < 0 || epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, _wake_fd, &ev) < 0)
+        {
+            const std::string err = std::strerror(errno);
+            for (Worker &w : _workers)
+            {
+                if (w.epoll_fd >= 0)
+                {
+                    close(w.epoll_fd);
+                }
+            }
+            close(_wake_fd);
+            throw UdpRxError("epoll error: " + err);
+        }
+    }
+
+    for (size_t idx = 0; idx < _workers.size(); idx++)
+    {
+        _workers[idx].thr = std::thread(&UdpRxReactor::run, this, std::ref(_workers[idx]), idx);
+    }
+}
+
+UdpRxReactor::~UdpRxReactor()
+{
+    _stop = true;
+    const std::uint64_t one = 1;
+    if (write(_wake_fd, &one, sizeof(one)) < 0 && _log_debug_print)
+    {
+        _log_debug_print("Can't wake up RX reactor threads");
+    }
+
+    for (Worker &worker : _workers)
+    {
+        if (worker.thr.joinable())
+        {
+            worker.thr.join();
+        }
+        close(worker.epoll_fd);
+    }
+    close(_wake_fd);
+}
+
+void UdpRxReactor::add(UdpRxContext &ctx)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+
+    Worker *worker = &_workers.front();
+    for (Worker &w : _workers)
+    {
+        if (w.load < worker->load)
+        {
+            worker = &w;
+        }
+    }
+
+    const std::uint64_t id = _next_id++;
+    {
+        std::lock_guard<std::mutex> worker_lock(worker->mtx);
+        std::unique_ptr<MmsgReceiver> receiver(new MmsgReceiver(ctx));
+        worker->registrations[id] = std::make_shared<Registration>(Registration{&ctx, std::move(receiver)});
+    }
 
-    const size_t num_of_channels = ctx->channels.size();
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = id;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, ctx.sock, &ev) < 0)
+    {
+        const std::string err = std::strerror(errno);
+        std::lock_guard<std::mutex> worker_lock(worker->mtx);
+        worker->registrations.erase(id);
+        throw UdpRxError("epoll_ctl error: " + err);
+    }
 
-    rx_buf.resize(num_bytes_expected);
+    worker->load++;
+    _sockets[&ctx] = std::make_pair(worker, id);
+}
 
-    fd_set readfds;
+void UdpRxReactor::remove(UdpRxContext &ctx)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
 
-    for (;;)
+    auto it = _sockets.find(&ctx);
+    if (it == _sockets.end())
     {
-        std::memset(&client_addr, 0, sizeof(client_addr));
-        socklen_t client_addr_len = sizeof(client_addr);
+        return;
+    }
 
-        int sock = ctx->sock;
-        // check for invalid socket
-        if (sock == -1)
+    Worker *worker = it->second.first;
+    {
+        std::unique_lock<std::mutex> worker_lock(worker->mtx);
+        if (worker->registrations.erase(it->second.second) != 0)
         {
-            break;
+            epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, ctx.sock, nullptr);
         }
-        FD_ZERO(&readfds);
-        FD_SET(sock, &readfds);
+        worker->idle.wait(worker_lock, [worker, &ctx]() { return worker->busy != &ctx; });
+    }
+    worker->load--;
+    _sockets.erase(it);
+}
 
-        struct timeval tv = {0, 200000}; // 0.2 seconds delay
-        int ret = select(sock + 1, &readfds, NULL, NULL, &tv);
+void UdpRxReactor::run(Worker &worker, size_t index)
+{
+    setup_rx_thread(_options, "afedri-rxr-" + std::to_string(index), _log_debug_print);
 
-        // check for force stop condition
-        if (ctx->flag_stop)
-        {
-            break;
-        }
+    constexpr int max_events = 16;
+    struct epoll_event events[max_events];
 
-        // check for invalid socket
-        if (ctx->sock == -1)
+    while (!_stop)
+    {
+        int num_events = epoll_wait(worker.epoll_fd, events, max_events, -1);
+        if (num_events < 0)
         {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (_log_debug_print)
+            {
+                _log_debug_print(std::string("epoll_wait error: ") + std::strerror(errno));
+            }
             break;
         }
 
-        // check for timeout
-        if (ret == 0)
-        {
-            continue;
-        }
-
-        // Read data. The call must be nonblocked because select told us we can read data.
-        int bytes_did_read =
-            recvfrom(ctx->sock, (char *)&rx_buf[0], (int)rx_buf.size(), 0, (struct sockaddr *)&client_addr, &client_addr_len);
-        if (bytes_did_read < 0)
+        for (int i = 0; i < num_events; i++)
         {
-            if (ctx->log_debug_print)
+            std::shared_ptr<Registration> registration;
             {
-                ctx->log_debug_print("reading error...");
+                // the socket might be removed after epoll_wait returned
+                std::lock_guard<std::mutex> lock(worker.mtx);
+                auto it = worker.registrations.find(events[i].data.u64);
+                if (it == worker.registrations.end())
+                {
+                    continue;
+                }
+                registration = it->second;
+                worker.busy = registration->ctx;
             }
-            break;
-        }
 
-        // check for force stop condition again
-        if (ctx->flag_stop)
-        {
-            break;
-        }
+            // without the lock: add() and remove() of other devices don't wait for the data to be pushed to streams
+            UdpRxContext &ctx = *registration->ctx;
+            const bool failed = registration->receiver->receive(ctx) < 0;
 
-        if (bytes_did_read != num_bytes_expected)
-        {
-            if (ctx->log_debug_print)
+            bool dead = false;
+            if (failed)
             {
-                std::ostringstream ss;
-                ss << "Num bytes expected=" << num_bytes_expected << ", num bytes read=" << bytes_did_read;
-                ctx->log_debug_print(ss.str());
+                std::lock_guard<std::mutex> lock(worker.mtx);
+                if (worker.registrations.erase(events[i].data.u64) != 0)
+                {
+                    epoll_ctl(worker.epoll_fd, EPOLL_CTL_DEL, ctx.sock, nullptr);
+                    dead = true;
+                }
             }
-            continue;
+            if (dead)
+            {
+                // same as exit of RX thread: the device is not alive anymore. The socket is closed by
+                // stop_working_thread_close_socket(), so its number can't be reused while the device still holds it.
+                ctx.flag_stop = true;
+                ctx.wake_readers();
+                if (_log_debug_print)
+                {
+                    _log_debug_print("RX reactor: receive error, socket is not served anymore");
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(worker.mtx);
+                worker.busy = nullptr;
+            }
+            worker.idle.notify_all();
         }
+    }
 
-        if (!ctx->rx_active)
+    if (_log_debug_print)
+    {
+        _log_debug_print("Exit RX reactor thread");
+    }
+}
+#endif
+
+bool PacketTimeTags::allocate(size_t buffer_size, size_t slot_len, bool lock)
+{
+    _slot_len = slot_len;
+    _num_slots = buffer_size / slot_len;
+    _packet_idx.reset(new std::atomic<std::uint64_t>[_num_slots]);
+    _time_ns.reset(new std::atomic<std::int64_t>[_num_slots]);
+    _packet_number.reset(new std::atomic<std::uint64_t>[_num_slots]);
+    for (size_t idx = 0; idx < _num_slots; idx++)
+    {
+        _packet_idx[idx].store(~std::uint64_t(0), std::memory_order_relaxed);
+        _time_ns[idx].store(0, std::memory_order_relaxed);
+        _packet_number[idx].store(0, std::memory_order_relaxed);
+    }
+
+    return !lock || (lock_memory(_packet_idx.get(), _num_slots * sizeof(_packet_idx[0])) &&
+                     lock_memory(_time_ns.get(), _num_slots * sizeof(_time_ns[0])) &&
+                     lock_memory(_packet_number.get(), _num_slots * sizeof(_packet_number[0])));
+}
+
+void PacketTimeTags::set(std::uint64_t pos, std::int64_t time_ns, std::uint64_t packet_number)
+{
+    const std::uint64_t packet_idx = pos / _slot_len;
+    const size_t slot = static_cast<size_t>(packet_idx % _num_slots);
+
+    _packet_idx[slot].store(~std::uint64_t(0), std::memory_order_relaxed); // invalidate while updating
+    std::atomic_thread_fence(std::memory_order_release);
+    _time_ns[slot].store(time_ns, std::memory_order_relaxed);
+    _packet_number[slot].store(packet_number, std::memory_order_relaxed);
+    _packet_idx[slot].store(packet_idx, std::memory_order_release);
+}
+
+bool PacketTimeTags::get_packet_number(std::uint64_t pos, std::uint64_t &packet_number) const
+{
+    if (_num_slots == 0)
+    {
+        return false;
+    }
+
+    const std::uint64_t packet_idx = pos / _slot_len;
+    const size_t slot = static_cast<size_t>(packet_idx % _num_slots);
+
+    const std::uint64_t idx1 = _packet_idx[slot].load(std::memory_order_acquire);
+    const std::uint64_t number = _packet_number[slot].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const std::uint64_t idx2 = _packet_idx[slot].load(std::memory_order_relaxed);
+    if (idx1 != packet_idx || idx2 != packet_idx)
+    {
+        return false;
+    }
+
+    packet_number = number;
+    return true;
+}
+
+// Position of element `pos` of the item in device numbering: packet number * slot_len + offset inside of packet.
+static bool device_position(StreamItem const &item, std::uint64_t pos, std::uint64_t &device_pos)
+{
+    const size_t slot_len = item.channel_ring->time_tags.slot_len();
+    std::uint64_t packet_number;
+    if (!item.channel_ring->time_tags.get_packet_number(pos, packet_number))
+    {
+        return false;
+    }
+    device_pos = packet_number * slot_len + pos % slot_len;
+    return true;
+}
+
+// Number of elements from `pos` up to `max_len` which belong to consecutive device packets.
+static size_t consecutive_elements(StreamItem const &item, std::uint64_t pos, size_t max_len)
+{
+    const PacketTimeTags &tags = item.channel_ring->time_tags;
+    const size_t slot_len = tags.slot_len();
+    const std::uint64_t head = item.channel_ring->ring.writePosition();
+    max_len = std::min(max_len, item.channel_ring->ring.size());
+
+    std::uint64_t packet_number;
+    if (head <= pos || !tags.get_packet_number(pos, packet_number))
+    {
+        return 0;
+    }
+
+    std::uint64_t next = pos - pos % slot_len + slot_len; // start of next packet
+    size_t len = static_cast<size_t>(std::min<std::uint64_t>({head, next, pos + max_len}) - pos);
+    while (len < max_len && next < head)
+    {
+        std::uint64_t next_number;
+        if (!tags.get_packet_number(next, next_number) || next_number != ++packet_number)
         {
-            // no need to do data processing (dummy read)
-            continue;
+            break; // gap: the packet was dropped in this channel, or it is being overwritten
         }
+        len += static_cast<size_t>(std::min<std::uint64_t>({head - next, slot_len, max_len - len}));
+        next += slot_len;
+    }
+    return len;
+}
 
-        short *buf = (short *)&rx_buf[4]; // skip 4 bytes (marker and packet count)
+size_t align_stream_items(std::vector<StreamItem *> const &items, size_t max_len, std::vector<std::uint64_t> &positions)
+{
+    // Usually channels are aligned already, an attempt fails only if the producer is overwriting data being looked at,
+    // or if channels dropped different packets.
+    constexpr int max_attempts = 8;
 
-        size_t pos = 0; // position in buf0, buf1, buf2, buf3
+    positions.resize(items.size());
+    if (items.empty())
+    {
+        return 0;
+    }
 
-        for (size_t idx = 0; idx < max_num_elements_in_block; /* no inc */)
+    for (int attempt = 0; attempt < max_attempts; attempt++)
+    {
+        // the most advanced channel gives the target
+        bool ok = true;
+        std::uint64_t target = 0;
+        for (size_t idx = 0; idx < items.size() && ok; idx++)
         {
-            for (size_t channel = 0; channel < num_of_channels; channel++)
+            positions[idx] = items[idx]->buffer.readPosition();
+            std::uint64_t device_pos;
+            if (items[idx]->channel_ring->ring.writePosition() <= positions[idx])
             {
-                // Take I+Q pair from UDP rx stream and put to specified channel's buffer
-                const short I = buf[idx];
-                const short Q = buf[idx + 1];
-                arr_buf[channel][pos] = I;
-                arr_buf[channel][pos + 1] = Q;
-
-                idx += 2; // step on one I+Q pair (2 shorts)
+                return 0; // no data in the channel
             }
-            pos += 2; // step on one I+Q pair
+            ok = device_position(*items[idx], positions[idx], device_pos);
+            target = std::max(target, device_pos);
         }
 
-        // pos - number of elements in each result buffer
-
-        // transfer from result buffers to buffers in context
-        for (size_t channel = 0; channel < num_of_channels; channel++)
+        // drop data of lagging channels up to the target
+        for (size_t idx = 0; idx < items.size() && ok; idx++)
         {
-            for (auto &stream : ctx->channels[channel])
+            StreamItem &item = *items[idx];
+            const size_t slot_len = item.channel_ring->time_tags.slot_len();
+            const std::uint64_t head = item.channel_ring->ring.writePosition();
+            std::uint64_t pos = positions[idx];
+            std::uint64_t device_pos;
+            ok = device_position(item, pos, device_pos);
+            while (ok && device_pos < target && pos < head)
             {
-                // only to active streams
-                if (stream.unique_stream_id)
+                if (device_pos / slot_len == target / slot_len)
+                {
+                    pos += target - device_pos; // same packet
+                    device_pos = target;
+                }
+                else
                 {
-                    std::unique_lock<std::mutex> lock(stream.mtx); // protect buffer
-                    stream.buffer.put(arr_buf[channel], pos);      // put data to each stream within same channels
+                    pos += slot_len - pos % slot_len; // next packet
+                    ok = pos >= head || device_position(item, pos, device_pos);
                 }
             }
-        }
 
-        // Notify them all.
-        for (size_t channel = 0; channel < num_of_channels; channel++)
-        {
-            for (auto &stream : ctx->channels[channel])
+            // Not counted as overflow: the packet is missing in other channel, which has reported its loss already.
+            if (ok && pos != positions[idx])
             {
-                if (stream.unique_stream_id)
-                {
-                    stream.signal.notify_one();
-                }
+                ok = item.buffer.commit(positions[idx], static_cast<size_t>(pos - positions[idx]));
+                positions[idx] = pos;
             }
+            if (ok && pos >= head)
+            {
+                return 0; // the channel has no data of target packet yet
+            }
+            ok = ok && device_pos == target; // otherwise the channel dropped target packet, next attempt gets a new target
+        }
+
+        if (!ok)
+        {
+            continue;
+        }
+
+        size_t len = max_len;
+        for (size_t idx = 0; idx < items.size(); idx++)
+        {
+            len = consecutive_elements(*items[idx], positions[idx], len);
         }
+        return len;
     }
 
-    if (ctx->sock != -1)
+    return 0;
+}
+
+bool PacketTimeTags::get(std::uint64_t pos, double sample_rate, std::int64_t &time_ns) const
+{
+    if (_num_slots == 0)
     {
-        closesocket(ctx->sock);
-        ctx->sock = -1;
+        return false;
     }
 
-    if (ctx->log_debug_print)
+    const std::uint64_t packet_idx = pos / _slot_len;
+    const size_t offset = static_cast<size_t>(pos % _slot_len);
+    const size_t slot = static_cast<size_t>(packet_idx % _num_slots);
+
+    const std::uint64_t idx1 = _packet_idx[slot].load(std::memory_order_acquire);
+    const std::int64_t t = _time_ns[slot].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const std::uint64_t idx2 = _packet_idx[slot].load(std::memory_order_relaxed);
+    if (idx1 != packet_idx || idx2 != packet_idx)
     {
-        ctx->log_debug_print("Exit RX thread");
+        return false;
+    }
+
+    if (offset == 0)
+    {
+        time_ns = t;
+        return true;
+    }
+
+    // inside of packet, need sample rate to calculate
+    if (sample_rate <= 0.0)
+    {
+        return false;
     }
+
+    time_ns = t + static_cast<std::int64_t>((offset / 2) * 1e9 / sample_rate); // I+Q per sample
+    return true;
 }
 
 void UdpRxContext::stop_working_thread_close_socket()
 {
+#if defined(__linux__)
+    if (reactor)
+    {
+        reactor->remove(*this);
+        reactor.reset(); // the last device stops reactor threads
+    }
+#endif
+
     if (sock != -1)
     {
         if (log_debug_print)
@@ -180,6 +1332,10 @@ void UdpRxContext::stop_working_thread_close_socket()
         closesocket(sock);
         sock = -1;
     }
+    else if (!replay_files.empty())
+    {
+        flag_stop = true; // replay thread has no socket to close
+    }
 
     // wait thread exit
     if (thr.joinable())
@@ -188,8 +1344,59 @@ void UdpRxContext::stop_working_thread_close_socket()
     }
 }
 
+void UdpRxContext::wake_readers()
+{
+    std::lock_guard<std::mutex> lock(mtx_channel);
+    for (auto &channel : channels)
+    {
+        for (auto &stream : channel)
+        {
+            stream.stop_waiting();
+        }
+    }
+}
+
+size_t UdpRxContext::elements_per_packet() const
+{
+    return max_num_elements_in_block / channels.size();
+}
+
+// Set socket receive buffer size if `size` is not zero. Returns actual size.
+static int set_receive_buffer_size(int sock, int size, void (*log_debug_print)(std::string const &))
+{
+    if (size > 0)
+    {
+        int ret = -1;
+#if defined(__linux__)
+        // SO_RCVBUFFORCE ignores rmem_max limit, but needs CAP_NET_ADMIN
+        ret = setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size));
+#endif
+        if (ret < 0)
+        {
+            ret = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char *)&size, sizeof(size));
+        }
+        if (ret < 0 && log_debug_print)
+        {
+            log_debug_print(std::string("Can't set socket receive buffer size: ") + get_error_text());
+        }
+    }
+
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *)&actual, &len);
+
+    if (log_debug_print)
+    {
+        std::ostringstream ss;
+        ss << "Socket receive buffer requested=" << size << " granted=" << actual;
+        log_debug_print(ss.str());
+    }
+
+    return actual;
+}
+
 std::shared_ptr<UdpRxContext> UdpRxControl::start_thread(size_t number_of_channels, std::string const &bind_address, int bind_port,
-                                                         void (*log_debug_print)(std::string const &))
+                                                         UdpRxOptions const &options, void (*log_debug_print)(std::string const &))
 {
     int sock = (int)socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0)
@@ -221,13 +1428,219 @@ std::shared_ptr<UdpRxContext> UdpRxControl::start_thread(size_t number_of_channe
         throw UdpRxError(ss.str());
     }
 
+#if defined(__linux__)
+    // ask kernel for receive time of every datagram
+    const int enable_timestamp = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &enable_timestamp, sizeof(enable_timestamp)) < 0 && log_debug_print)
+    {
+        log_debug_print("SO_TIMESTAMPNS is not supported, user space receive time will be used.");
+    }
+
+    // ask kernel for number of datagrams dropped due to full receive buffer
+    const int enable_ovfl = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &enable_ovfl, sizeof(enable_ovfl)) < 0 && log_debug_print)
+    {
+        log_debug_print("SO_RXQ_OVFL is not supported, kernel drops will not be reported.");
+    }
+#endif
+
     auto ctx = std::make_shared<UdpRxContext>(sock, number_of_channels);
     ctx->log_debug_print = log_debug_print;
+    ctx->rcvbuf_granted = set_receive_buffer_size(sock, options.rcvbuf, log_debug_print);
+    ctx->thread_name = "afedri-rx-" + std::to_string(bind_port); // max 15 characters
+    ctx->options = options;
+    if (ctx->options.batch_size == 0)
+    {
+        ctx->options.batch_size = 1;
+    }
+
+#if defined(__linux__) && !defined(AFEDRI_IO_URING)
+    if (ctx->options.engine == UdpRxEngine::IoUring)
+    {
+        if (log_debug_print)
+        {
+            log_debug_print("Driver is built without io_uring support (AFEDRI_IO_URING), recvmmsg engine will be used.");
+        }
+        ctx->options.engine = UdpRxEngine::RecvMmsg;
+    }
+#endif
+#if defined(__linux__)
+    if (ctx->options.engine == UdpRxEngine::Reactor)
+    {
+        // no own thread, socket is served by shared reactor threads
+        try
+        {
+            ctx->reactor = UdpRxReactor::instance(ctx->options, log_debug_print);
+            ctx->reactor->add(*ctx);
+        }
+        catch (...)
+        {
+            closesocket(sock);
+            throw;
+        }
+        return ctx;
+    }
+#else
+    if (ctx->options.engine != UdpRxEngine::Select)
+    {
+        if (log_debug_print)
+        {
+            log_debug_print("recvmmsg and epoll are not available on this platform, select engine will be used.");
+        }
+        ctx->options.engine = UdpRxEngine::Select;
+    }
+#endif
     ctx->thr = std::thread(net_recv_operation, ctx); // start thread, place object to context
 
     return ctx;
 }
 
+// Runs of packets present in every channel file. A capture of a file holds whole packets from its packet number on, up to
+// the next capture or the end of file. Captures without packet number can't be lined up and are skipped.
+static std::vector<ReplayRun> align_channel_files(std::vector<std::vector<ReplayCapture>> const &captures,
+                                                  std::vector<std::uint64_t> const &file_samples, size_t samples_per_packet)
+{
+    struct Segment
+    {
+        std::uint64_t first_packet;
+        std::uint64_t num_packets;
+        std::uint64_t offset; // elements
+    };
+
+    std::vector<std::vector<Segment>> segments(captures.size());
+    for (size_t channel = 0; channel < captures.size(); channel++)
+    {
+        auto const &caps = captures[channel];
+        for (size_t idx = 0; idx < caps.size(); idx++)
+        {
+            const std::uint64_t end = (idx + 1 < caps.size()) ? caps[idx + 1].sample_start : file_samples[channel];
+            if (caps[idx].has_packet_number && end > caps[idx].sample_start)
+            {
+                const std::uint64_t num_packets = (end - caps[idx].sample_start) / samples_per_packet;
+                segments[channel].push_back(Segment{caps[idx].packet_number, num_packets, caps[idx].sample_start * 2});
+            }
+        }
+    }
+
+    std::vector<ReplayRun> runs;
+    std::vector<size_t> seg_idx(captures.size(), 0);
+    std::uint64_t packet = 0; // first packet not looked at yet
+    for (;;)
+    {
+        // segment of every channel which holds `packet` or comes after it
+        bool all_have = true;
+        for (size_t channel = 0; channel < segments.size(); channel++)
+        {
+            auto const &segs = segments[channel];
+            size_t &idx = seg_idx[channel];
+            while (idx < segs.size() && segs[idx].first_packet + segs[idx].num_packets <= packet)
+            {
+                idx++;
+            }
+            if (idx == segs.size())
+            {
+                return runs;
+            }
+            if (segs[idx].first_packet > packet)
+            {
+                packet = segs[idx].first_packet; // missing in this channel
+                all_have = false;
+            }
+        }
+        if (!all_have)
+        {
+            continue;
+        }
+
+        ReplayRun run;
+        run.num_packets = ~std::uint64_t(0);
+        for (size_t channel = 0; channel < segments.size(); channel++)
+        {
+            Segment const &seg = segments[channel][seg_idx[channel]];
+            run.num_packets = std::min(run.num_packets, seg.first_packet + seg.num_packets - packet);
+            run.offsets.push_back(seg.offset + (packet - seg.first_packet) * samples_per_packet * 2);
+        }
+        runs.push_back(run);
+        packet += run.num_packets;
+    }
+}
+
+std::shared_ptr<UdpRxContext> UdpRxControl::start_replay_thread(size_t number_of_channels, ReplayOptions const &replay,
+                                                                UdpRxOptions const &options, void (*log_debug_print)(std::string const &))
+{
+    const bool channel_files = !replay.channel_files.empty();
+    if (channel_files && (replay.channel_files.size() != number_of_channels || replay.captures.size() != number_of_channels))
+    {
+        throw UdpRxError("replay needs a file and its captures for every channel");
+    }
+
+    std::vector<std::shared_ptr<MappedFile>> files;
+    try
+    {
+        for (std::string const &path : channel_files ? replay.channel_files : std::vector<std::string>{replay.file})
+        {
+            files.push_back(std::make_shared<MappedFile>(path));
+        }
+    }
+    catch (std::runtime_error const &ex)
+    {
+        throw UdpRxError(ex.what());
+    }
+
+    std::vector<ReplayRun> runs;
+    if (channel_files)
+    {
+        const size_t samples_per_packet = max_num_elements_in_block / number_of_channels / 2;
+        std::vector<std::uint64_t> file_samples;
+        for (auto const &file : files)
+        {
+            file_samples.push_back(file->size() / (2 * sizeof(short)));
+        }
+        runs = align_channel_files(replay.captures, file_samples, samples_per_packet);
+
+        std::uint64_t num_packets = 0;
+        for (ReplayRun const &run : runs)
+        {
+            num_packets += run.num_packets;
+        }
+        if (num_packets == 0)
+        {
+            std::string files;
+            for (std::string const &file : replay.channel_files)
+            {
+                files += (files.empty() ? "" : ", ") + file;
+            }
+            throw UdpRxError("channel files " + files + " have no packets in common (afedri:packet_number of captures)");
+        }
+        if (log_debug_print)
+        {
+            log_debug_print("Replay of " + std::to_string(number_of_channels) + " channel files: " + std::to_string(num_packets) +
+                            " packets in " + std::to_string(runs.size()) + " run(s) present in all channels.");
+        }
+    }
+
+    auto ctx = std::make_shared<UdpRxContext>(-1, number_of_channels);
+    ctx->log_debug_print = log_debug_print;
+    ctx->thread_name = "afedri-replay"; // max 15 characters
+    ctx->options = options;
+    if (ctx->options.batch_size == 0)
+    {
+        ctx->options.batch_size = 1;
+    }
+    ctx->replay_files = files;
+    ctx->replay_runs = std::move(runs);
+    ctx->replay = replay;
+    ctx->replay_rate.store(replay.sample_rate);
+    if (log_debug_print && !channel_files && files[0]->size() % num_data_bytes_in_block != 0)
+    {
+        log_debug_print("Replay file size is not a multiple of packet payload (1024 bytes), the tail is ignored.");
+    }
+
+    ctx->thr = std::thread(replay_operation, ctx);
+
+    return ctx;
+}
+
 void UdpRxControl::stop_thread(std::shared_ptr<UdpRxContext> ctx)
 {
     ctx->stop_working_thread_close_socket();
@@ -3,32 +3,280 @@
 #pragma once
 
 #include "buffer.hpp"
+#include "iq_correction.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <deque>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
+
+class UdpRxReactor;
+class MappedFile;
+
+// Arrival time and device packet number of every packet put to a stream buffer, addressed by buffer stream position.
+// An entry is guarded by its packet index (seqlock), so a reader lagging by a whole ring gets no time instead of a wrong one.
+// All channels of the device tag the same packet with the same packet number, which lines up rings of different channels.
+class PacketTimeTags
+{
+  public:
+    PacketTimeTags() = default;
+
+    // Only when producer and consumer are not active. Returns false if `lock` was asked but memory can't be locked.
+    bool allocate(size_t buffer_size, size_t slot_len, bool lock = false);
+
+    // producer side, before the packet is put to buffer
+    void set(std::uint64_t pos, std::int64_t time_ns, std::uint64_t packet_number);
+
+    // consumer side. Time of element at stream position `pos`. Returns false if unknown.
+    bool get(std::uint64_t pos, double sample_rate, std::int64_t &time_ns) const;
+    // consumer side. Device packet number of the packet holding stream position `pos`. Returns false if unknown.
+    bool get_packet_number(std::uint64_t pos, std::uint64_t &packet_number) const;
+
+    size_t slot_len() const
+    {
+        return _slot_len;
+    }
+
+  private:
+    size_t _slot_len{1};
+    size_t _num_slots{0};
+    std::unique_ptr<std::atomic<std::uint64_t>[]> _packet_idx;
+    std::unique_ptr<std::atomic<std::int64_t>[]> _time_ns;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> _packet_number;
+};
+
+// Data of one hardware channel. Written once by RX thread, read by every stream of the channel through its own CRingReader.
+// The channel ring is always written, lagging readers lose their oldest data. A stream which must keep its queued data
+// (other overflow policies, direct access) reads a ChannelRing of its own, written for it alone.
+struct ChannelRing
+{
+    CSharedRing ring;
+    PacketTimeTags time_tags; // receive time of packets in ring
+    IqCorrector correction;   // DC offset and IQ imbalance, applied before data is put to ring. Not used in own ring of a stream.
+};
 
 struct StreamItem
 {
-    StreamItem(int stream_id)
-        : unique_stream_id(stream_id){};
+    StreamItem(int stream_id, ChannelRing &ring)
+        : unique_stream_id(stream_id), channel_ring(&ring)
+    {
+        buffer.attach(&ring.ring);
+    }
+
+    // Consumer side. Only for inactive stream. Start reading from the newest data of the channel.
+    void reset()
+    {
+        buffer.reset();
+        reset_overflow();
+    }
+
+    // Consumer side. Only for inactive stream. Read `ring`: the channel ring or `own_ring`.
+    void use_ring(ChannelRing &ring)
+    {
+        channel_ring = &ring;
+        buffer.attach(&ring.ring);
+    }
+
+    // Consumer side. Producer puts data to active streams only. After deactivation returns, producer doesn't touch the stream.
+    void set_active(bool value)
+    {
+        active.store(value, std::memory_order_seq_cst);
+        while (!value && producing.load(std::memory_order_seq_cst))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // Producer side. Returns true if stream is active, then end_produce() must be called.
+    bool begin_produce()
+    {
+        producing.store(true, std::memory_order_seq_cst); // pairs with set_active()
+        if (active.load(std::memory_order_seq_cst))
+        {
+            return true;
+        }
+        producing.store(false, std::memory_order_release);
+        return false;
+    }
+
+    void end_produce()
+    {
+        producing.store(false, std::memory_order_release);
+    }
+
+    // Consumer side. Block until at least `min_elements` are buffered (capped by half of the ring). If that doesn't happen
+    // within `max_latency`, return with whatever is buffered, or keep waiting for any data up to `timeout`.
+    // Returns true if data is available. Doesn't wait after stop_waiting().
+    bool wait_for_data(std::chrono::microseconds timeout, size_t min_elements = 1,
+                       std::chrono::microseconds max_latency = std::chrono::microseconds::max())
+    {
+        min_elements = std::max<size_t>(1, std::min(min_elements, buffer.size() / 2));
+        if (buffer.elementsAvailable() >= min_elements)
+        {
+            return true;
+        }
+        if (source_stopped.load(std::memory_order_acquire))
+        {
+            return buffer.elementsAvailable() > 0;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        const auto deadline = now + timeout;
+        const auto latency_deadline = now + std::min(timeout, max_latency);
+
+        std::unique_lock<std::mutex> lock(mtx);
+        wake_threshold.store(min_elements, std::memory_order_relaxed);
+        reader_waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in notify()
+        bool res = signal.wait_until(lock, latency_deadline, [this, min_elements]() {
+            return buffer.elementsAvailable() >= min_elements || source_stopped.load(std::memory_order_acquire);
+        });
+        if (!res || source_stopped.load(std::memory_order_acquire))
+        {
+            // threshold not reached in time: any data will do
+            wake_threshold.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in notify()
+            res = signal.wait_until(lock, deadline, [this]() {
+                return buffer.elementsAvailable() > 0 || source_stopped.load(std::memory_order_acquire);
+            });
+            res = res && buffer.elementsAvailable() > 0;
+        }
+        reader_waiting.store(false, std::memory_order_relaxed);
+        return res;
+    }
+
+    // Any thread. No more data will come (RX thread or reactor failed): wake up the reader and don't let it sleep again.
+    void stop_waiting()
+    {
+        source_stopped.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mtx); // reader is either before predicate check or already sleeping
+        }
+        signal.notify_all();
+    }
+
+    // Producer side. Wake up the reader only if it sleeps and enough data for it is buffered.
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fences in wait_for_data()
+        if (reader_waiting.load(std::memory_order_relaxed) && buffer.elementsQueued() >= wake_threshold.load(std::memory_order_relaxed))
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx); // reader is either before predicate check or already sleeping
+            }
+            signal.notify_one();
+        }
+    }
+
+    // Consumer side. Returns true once after the stream lost data (network packet loss or buffer overflow).
+    bool take_overflow()
+    {
+        const size_t dropped = buffer.elementsDropped();
+        const bool buffer_overflow = dropped != dropped_reported;
+        dropped_reported = dropped;
+        return data_lost.exchange(false, std::memory_order_relaxed) || buffer_overflow;
+    }
 
-    int unique_stream_id; // 0 means unused
-    std::mutex mtx{};     // common mutex to protect access to any of buffers
+    // Consumer side. Forget losses happened before the slot was given to a new stream.
+    void reset_overflow()
+    {
+        data_lost.store(false, std::memory_order_relaxed);
+        dropped_reported = buffer.elementsDropped();
+    }
+
+    // Producer side. True between successful begin_produce() and end_produce().
+    bool is_producing() const
+    {
+        return producing.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<int> unique_stream_id; // 0 means unused
+    std::mutex mtx{};                  // used only to sleep on signal, buffer access is lock-free
     std::condition_variable signal{};
-    CBuffer buffer{1024 * 1024}; // 1Mb should be enough
+    std::atomic<bool> reader_waiting{false};
+    std::atomic<size_t> wake_threshold{1}; // number of buffered elements to wake up the waiting reader
+    std::atomic<bool> active{false};
+    std::atomic<bool> producing{false};
+    std::atomic<bool> source_stopped{false}; // set by stop_waiting(), never cleared: the context is dead
+    ChannelRing *channel_ring;          // ring the stream reads: ring of the hardware channel or own_ring
+    std::unique_ptr<ChannelRing> own_ring{}; // allocated for streams which can't share the channel ring
+    CRingReader buffer{};               // read cursor in channel_ring
+    std::atomic<bool> data_lost{false}; // set by producer when UDP packets were lost
+    size_t dropped_reported{0};         // consumer only, buffer.elementsDropped() at last check
 };
 
 // we use deque because it allows to store objects with deleted copy constructor
 typedef std::deque<StreamItem> StreamsWithinChannel;
 
+enum class UdpRxEngine
+{
+    Select = 0,   // select() + recvfrom() for every datagram
+    RecvMmsg = 1, // drain up to batch_size datagrams with one recvmmsg() call (Linux only)
+    Reactor = 2,  // no own thread, socket is served by process-wide epoll threads shared by all devices (Linux only)
+    IoUring = 3,  // io_uring multishot recvmsg into provided buffers (Linux 6.0+, built with AFEDRI_IO_URING)
+};
+
+enum class UdpRxSched
+{
+    Default = 0,    // don't change scheduling of RX thread
+    Fifo = 1,       // SCHED_FIFO
+    RoundRobin = 2, // SCHED_RR
+};
+
+struct UdpRxOptions
+{
+    UdpRxEngine engine{UdpRxEngine::Select};
+    size_t batch_size{32};                 // max number of datagrams per recvmmsg() call or per push to streams
+    int rcvbuf{0};                         // socket receive buffer size in bytes, 0 - system default
+    std::vector<int> cpus{};               // CPUs the RX thread may run on, empty - any (Linux only)
+    UdpRxSched sched{UdpRxSched::Default}; // real-time scheduling of RX thread (Linux only)
+    int sched_priority{0};                 // priority for Fifo/RoundRobin
+    size_t reactor_threads{1};             // number of threads of shared reactor, used by the device which starts it
+    bool huge_pages{false};                // back stream rings with huge pages (Linux only)
+    bool lock_memory{false};               // mlock stream rings and packet buffers of RX thread
+};
+
+// SigMF capture segment of a channel file: samples from `sample_start` on come from device packets from `packet_number` on.
+struct ReplayCapture
+{
+    std::uint64_t sample_start{0};
+    bool has_packet_number{false};
+    std::uint64_t packet_number{0};
+};
+
+// Data source of a replay context: capture files served instead of UDP packets. Either one file of CS16 payload of
+// device packets as they come: I+Q of every channel in turn (SigMF ci16_le, core:num_channels), or a file per channel
+// as IqRecorder writes them. Channel files are lined up by packet numbers of their captures, packets missing in any
+// of them are skipped.
+struct ReplayOptions
+{
+    std::string file{};                                 // interleaved file, not read if channel_files are given
+    std::vector<std::string> channel_files{};           // file per channel
+    std::vector<std::vector<ReplayCapture>> captures{}; // captures of every channel file
+    double sample_rate{0.0}; // pace, samples per second per channel. Also gives packet times. 0 - free running
+    bool paced{true};        // false - as fast as the RX thread can push, for benchmarks
+    bool loop{true};         // start over at end of file, otherwise stop producing data
+};
+
+// Packets present in all channel files of a replay, `offsets` are element offsets of the first of them in every file.
+struct ReplayRun
+{
+    std::vector<std::uint64_t> offsets{};
+    std::uint64_t num_packets{0};
+};
+
 struct UdpRxContext
 {
     UdpRxContext(int socket, size_t number_of_channels)
-        : sock(socket), channels(number_of_channels)
+        : sock(socket), channels(number_of_channels), rings(number_of_channels)
     {
     }
     UdpRxContext() = delete;
@@ -37,18 +285,36 @@ struct UdpRxContext
 
     bool is_alive() const
     {
-        return sock != -1 && !flag_stop;
+        return (sock != -1 || !replay_files.empty()) && !flag_stop;
     }
 
     void stop_working_thread_close_socket(); // The only correct way to stop attached thread
 
+    void wake_readers(); // RX side gave up: readers waiting for data of any stream return at once
+
+    size_t elements_per_packet() const; // number of elements (I or Q) each channel gets from one UDP packet
+
     int sock;
     std::vector<StreamsWithinChannel> channels; // possible number of elements in the vector: 1,2,4
+    std::deque<ChannelRing> rings;              // one per channel, allocated on first stream activation
     std::mutex mtx_channel{};                   // mutex to protect multiple modify access to channels
-    std::thread thr{};
-    bool flag_stop{false};
+    std::thread thr{};                          // own RX thread, not used with UdpRxEngine::Reactor
+    std::shared_ptr<UdpRxReactor> reactor{};    // shared RX threads for UdpRxEngine::Reactor
+    std::atomic<bool> flag_stop{false}; // set by device on stop, or by reactor thread on receive error
     bool rx_active{false};
+    UdpRxOptions options{};
+    std::uint16_t last_packet_seq{0};           // RX thread only
+    bool packet_seq_valid{false};               // RX thread only, false until first packet after start of capture
+    std::uint64_t packet_number{0};             // RX thread only, number of the next packet put to channel rings
+    std::atomic<std::uint64_t> packets_lost{0}; // total number of UDP packets lost in network
+    std::atomic<std::uint32_t> kernel_drops{0}; // datagrams dropped by kernel due to full socket buffer (SO_RXQ_OVFL, Linux)
+    int rcvbuf_granted{0};                      // actual socket receive buffer size
+    std::string thread_name{};                  // name of RX thread visible in top/perf
     void (*log_debug_print)(std::string const &){}; // function to print string to log.
+    std::vector<std::shared_ptr<MappedFile>> replay_files{}; // replay context: source of data, no socket
+    std::vector<ReplayRun> replay_runs{};                   // replay of channel files: packets to replay
+    ReplayOptions replay{};
+    std::atomic<double> replay_rate{0.0}; // pace of replay, may be changed while running
 };
 
 // Special class wrapper to initiate rx thread stop on destroing.
@@ -63,7 +329,7 @@ class UdpRxContextDefer
     {
         _ctx->stop_working_thread_close_socket();
     }
-    std::shared_ptr<UdpRxContext> get_ctx()
+    std::shared_ptr<UdpRxContext> const &get_ctx() const
     {
         return _ctx;
     }
@@ -81,6 +347,13 @@ class UdpRxError : public std::runtime_error
     }
 };
 
+// Consumer side, for a stream reading several channels of the device.
+// Moves read positions of lagging channels forward (discarding their unmatched data) until all channels point to the same
+// sample of the same packet. `positions` gets aligned read positions, one per item. Returns number of elements which
+// can be read from all channels at these positions (data of the same packets), up to `max_len`; 0 if none.
+// Read data must be committed with CRingReader::commit() for every channel.
+size_t align_stream_items(std::vector<StreamItem *> const &items, size_t max_len, std::vector<std::uint64_t> &positions);
+
 // Util class with two static methods.
 class UdpRxControl
 {
@@ -89,6 +362,9 @@ class UdpRxControl
 
   public:
     static std::shared_ptr<UdpRxContext> start_thread(size_t number_of_channels, std::string const &bind_address, int bind_port,
-                                                      void (*log_debug_print)(std::string const &));
+                                                      UdpRxOptions const &options, void (*log_debug_print)(std::string const &));
+    // RX thread feeding streams from a memory mapped capture file instead of a socket. Throws UdpRxError if the file can't be mapped.
+    static std::shared_ptr<UdpRxContext> start_replay_thread(size_t number_of_channels, ReplayOptions const &replay,
+                                                             UdpRxOptions const &options, void (*log_debug_print)(std::string const &));
     static void stop_thread(std::shared_ptr<UdpRxContext> ctx);
 };
@@ -0,0 +1,275 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#include "uring_recv.hpp"
+
+#include "portable_utils.h"
+
+#if defined(AFEDRI_IO_URING)
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+constexpr size_t max_provided_buffers = 32768; // kernel limit of provided buffer ring
+constexpr unsigned sq_entries = 4;             // only one multishot request is used
+
+static std::string error_text(std::string const &what, int err)
+{
+    return what + ": " + std::strerror(err);
+}
+
+static size_t round_up_pow2(size_t value)
+{
+    size_t res = 1;
+    while (res < value)
+    {
+        res <<= 1;
+    }
+    return res;
+}
+
+UringRecv::UringRecv(int sock, size_t num_buffers, size_t payload_len, size_t control_len, bool lock)
+    : _sock(sock), _num_buffers(std::min(round_up_pow2(std::max<size_t>(num_buffers, 2)), max_provided_buffers)),
+      _buf_len((sizeof(struct io_uring_recvmsg_out) + control_len + payload_len + 63) & ~size_t(63)) // cache line aligned buffers
+{
+    std::memset(&_msg_template, 0, sizeof(_msg_template));
+    _msg_template.msg_controllen = control_len; // room reserved for control messages in every buffer
+
+    try
+    {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = static_cast<unsigned>(2 * _num_buffers); // every buffer may be in CQ, never overflow
+
+        _ring_fd = (int)syscall(__NR_io_uring_setup, sq_entries, &params);
+        if (_ring_fd < 0)
+        {
+            throw UringRecvError(error_text("io_uring_setup", errno));
+        }
+
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+        {
+            throw UringRecvError("io_uring of this kernel is too old");
+        }
+
+        _rings_len = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+        _rings_ptr = mmap(nullptr, _rings_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+        if (_rings_ptr == MAP_FAILED)
+        {
+            _rings_ptr = nullptr;
+            throw UringRecvError(error_text("io_uring rings mmap", errno));
+        }
+
+        _sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+        _sqes_ptr = mmap(nullptr, _sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+        if (_sqes_ptr == MAP_FAILED)
+        {
+            _sqes_ptr = nullptr;
+            throw UringRecvError(error_text("io_uring sqes mmap", errno));
+        }
+
+        unsigned char *rings = static_cast<unsigned char *>(_rings_ptr);
+        _sq_tail = reinterpret_cast<unsigned *>(rings + params.sq_off.tail);
+        _sq_mask = reinterpret_cast<unsigned *>(rings + params.sq_off.ring_mask);
+        _cq_head = reinterpret_cast<unsigned *>(rings + params.cq_off.head);
+        _cq_tail = reinterpret_cast<unsigned *>(rings + params.cq_off.tail);
+        _cq_mask = reinterpret_cast<unsigned *>(rings + params.cq_off.ring_mask);
+        _cqes = rings + params.cq_off.cqes;
+
+        unsigned *sq_array = reinterpret_cast<unsigned *>(rings + params.sq_off.array);
+        for (unsigned idx = 0; idx < params.sq_entries; idx++)
+        {
+            sq_array[idx] = idx; // SQE index is always the same as SQ slot
+        }
+
+        // ring of provided buffers must be page aligned
+        _buf_ring_len = _num_buffers * sizeof(struct io_uring_buf);
+        _buf_ring_ptr = mmap(nullptr, _buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (_buf_ring_ptr == MAP_FAILED)
+        {
+            _buf_ring_ptr = nullptr;
+            throw UringRecvError(error_text("provided buffer ring mmap", errno));
+        }
+
+        struct io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<std::uint64_t>(_buf_ring_ptr);
+        reg.ring_entries = static_cast<std::uint32_t>(_num_buffers);
+        reg.bgid = 0;
+        if (syscall(__NR_io_uring_register, _ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        {
+            throw UringRecvError(error_text("io_uring provided buffer ring", errno));
+        }
+
+        _buffers.resize(_num_buffers * _buf_len); // zero fill prefaults them
+        _buffers_locked = lock && lock_memory(_buffers.data(), _buffers.size()) && lock_memory(_buf_ring_ptr, _buf_ring_len);
+        for (unsigned bid = 0; bid < _num_buffers; bid++)
+        {
+            recycle_buffer(bid);
+        }
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+}
+
+UringRecv::~UringRecv()
+{
+    release();
+}
+
+void UringRecv::release()
+{
+    // closing the ring cancels the receive request and unregisters provided buffers
+    if (_ring_fd >= 0)
+    {
+        close(_ring_fd);
+        _ring_fd = -1;
+    }
+    if (_buf_ring_ptr)
+    {
+        munmap(_buf_ring_ptr, _buf_ring_len);
+        _buf_ring_ptr = nullptr;
+    }
+    if (_sqes_ptr)
+    {
+        munmap(_sqes_ptr, _sqes_len);
+        _sqes_ptr = nullptr;
+    }
+    if (_rings_ptr)
+    {
+        munmap(_rings_ptr, _rings_len);
+        _rings_ptr = nullptr;
+    }
+}
+
+void UringRecv::recycle_buffer(unsigned bid)
+{
+    // io_uring_buf_ring::bufs is not used: in C++ its flexible array declaration is shifted by 8 bytes.
+    // Tail of the ring overlays `resv` of the first entry.
+    struct io_uring_buf *bufs = static_cast<struct io_uring_buf *>(_buf_ring_ptr);
+    struct io_uring_buf *buf = &bufs[_buf_tail & (_num_buffers - 1)];
+    buf->addr = reinterpret_cast<std::uint64_t>(&_buffers[bid * _buf_len]);
+    buf->len = static_cast<std::uint32_t>(_buf_len);
+    buf->bid = static_cast<std::uint16_t>(bid);
+    _buf_tail++;
+    __atomic_store_n(&bufs[0].resv, _buf_tail, __ATOMIC_RELEASE);
+}
+
+void UringRecv::arm()
+{
+    const unsigned tail = *_sq_tail;
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(_sqes_ptr) + (tail & *_sq_mask);
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = _sock;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&_msg_template);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    _to_submit++;
+    _armed = true;
+}
+
+int UringRecv::wait(int timeout_ms)
+{
+    if (!_armed)
+    {
+        arm();
+    }
+
+    const bool cq_empty = *_cq_head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+
+    struct io_uring_getevents_arg arg;
+    std::memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+
+    int ret = (int)syscall(__NR_io_uring_enter, _ring_fd, _to_submit, cq_empty ? 1 : 0, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                           &arg, sizeof(arg));
+    if (ret < 0)
+    {
+        const int err = errno;
+        return (err == ETIME || err == EINTR || err == EAGAIN || err == EBUSY) ? 0 : -err;
+    }
+
+    _to_submit -= std::min<unsigned>(static_cast<unsigned>(ret), _to_submit);
+    return 0;
+}
+
+int UringRecv::next(Datagram &dgram)
+{
+    if (_buffer_in_use)
+    {
+        recycle_buffer(_bid_in_use);
+        _buffer_in_use = false;
+    }
+
+    for (;;)
+    {
+        const unsigned head = *_cq_head;
+        if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+        {
+            return 0;
+        }
+
+        const struct io_uring_cqe *cqe = static_cast<const struct io_uring_cqe *>(_cqes) + (head & *_cq_mask);
+        const int res = cqe->res;
+        const unsigned flags = cqe->flags;
+        __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+
+        if (!(flags & IORING_CQE_F_MORE))
+        {
+            _armed = false; // multishot request finished, next wait() submits a new one
+        }
+
+        if (res < 0)
+        {
+            if (res == -ENOBUFS)
+            {
+                continue; // all buffers were in use, request stopped and datagrams wait in socket queue
+            }
+            return res;
+        }
+
+        if (!(flags & IORING_CQE_F_BUFFER))
+        {
+            continue;
+        }
+
+        // buffer layout: io_uring_recvmsg_out, name (not requested), control, payload
+        const unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        unsigned char *buf = &_buffers[bid * _buf_len];
+        const struct io_uring_recvmsg_out *out = reinterpret_cast<const struct io_uring_recvmsg_out *>(buf);
+        unsigned char *control = buf + sizeof(*out) + _msg_template.msg_namelen;
+
+        std::memset(&dgram.msg, 0, sizeof(dgram.msg));
+        dgram.msg.msg_control = control;
+        dgram.msg.msg_controllen = out->controllen;
+        dgram.payload = control + _msg_template.msg_controllen;
+        dgram.len = out->payloadlen;
+
+        _buffer_in_use = true;
+        _bid_in_use = bid;
+        return 1;
+    }
+}
+
+#endif
@@ -0,0 +1,94 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+// Built only with AFEDRI_IO_URING (cmake -DAFEDRI_IO_URING=ON), needs Linux 6.0+ headers and kernel.
+#if defined(AFEDRI_IO_URING)
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+class UringRecvError : public std::runtime_error
+{
+  public:
+    UringRecvError(const std::string &what = "")
+        : std::runtime_error(what)
+    {
+    }
+};
+
+// Minimal io_uring wrapper: one multishot recvmsg request of a datagram socket which receives into a ring
+// of kernel provided buffers. Datagrams land directly in the registered buffers, no syscall per packet.
+// Uses raw syscalls, so liburing is not needed. Not thread safe, all calls from the RX thread.
+class UringRecv
+{
+  public:
+    // `num_buffers` is rounded up to power of 2. Throws UringRecvError if io_uring or provided buffers are not supported.
+    // `lock` - mlock provided buffers, failure is not fatal (see buffers_locked()).
+    UringRecv(int sock, size_t num_buffers, size_t payload_len, size_t control_len, bool lock = false);
+    ~UringRecv();
+    UringRecv(UringRecv &) = delete;
+    UringRecv &operator=(UringRecv const &) = delete;
+
+    struct Datagram
+    {
+        const unsigned char *payload; // data in provided buffer
+        size_t len;                   // real length of datagram, may be larger than payload_len if truncated
+        struct msghdr msg;            // only msg_control/msg_controllen are set, for CMSG_* macros
+    };
+
+    // (Re)arm receive request if needed and wait until a completion arrives or `timeout_ms` passes.
+    // Returns 0 or negative errno of fatal error.
+    int wait(int timeout_ms);
+
+    // Next completed datagram, valid until the next call. Buffer of the previous one is given back to kernel.
+    // Returns 1 - got datagram, 0 - no more completions, negative - errno of failed receive request.
+    int next(Datagram &dgram);
+
+    bool buffers_locked() const
+    {
+        return _buffers_locked;
+    }
+
+  private:
+    void arm();
+    void release();
+    void recycle_buffer(unsigned bid);
+
+    int _sock;
+    int _ring_fd{-1};
+    size_t _num_buffers;
+    size_t _buf_len; // io_uring_recvmsg_out + control + payload
+    struct msghdr _msg_template;
+
+    // mapped rings
+    void *_rings_ptr{nullptr};
+    size_t _rings_len{0};
+    void *_sqes_ptr{nullptr};
+    size_t _sqes_len{0};
+    void *_buf_ring_ptr{nullptr};
+    size_t _buf_ring_len{0};
+
+    // pointers to ring fields
+    unsigned *_sq_tail{nullptr};
+    unsigned *_sq_mask{nullptr};
+    unsigned *_cq_head{nullptr};
+    unsigned *_cq_tail{nullptr};
+    unsigned *_cq_mask{nullptr};
+    void *_cqes{nullptr};
+
+    std::vector<unsigned char> _buffers;
+    std::uint16_t _buf_tail{0}; // local copy of provided buffer ring tail
+    bool _buffers_locked{false};
+    bool _armed{false};         // multishot request is active
+    unsigned _to_submit{0};
+    bool _buffer_in_use{false}; // buffer of datagram returned by last next()
+    unsigned _bid_in_use{0};
+};
+
+#endif
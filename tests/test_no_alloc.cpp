@@ -0,0 +1,197 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+
+// Steady-state streaming must not allocate: operator new and malloc are counted while readStream runs in a loop
+// on a replay device (the RX thread pushing data is counted too). Any allocation fails the test.
+
+#include "soapy_afedri.hpp"
+
+#include <SoapySDR/Formats.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+static std::atomic<bool> counting{false};
+static std::atomic<size_t> allocations{0};
+
+static void count_allocation()
+{
+    if (counting.load(std::memory_order_relaxed))
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void *operator new(size_t size)
+{
+    count_allocation();
+    void *ptr = std::malloc(size != 0 ? size : 1);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, std::nothrow_t const &) noexcept
+{
+    count_allocation();
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void *operator new[](size_t size, std::nothrow_t const &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#if defined(__GLIBC__)
+// malloc family of C code and of the C++ runtime
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t num, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+    count_allocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t num, size_t size)
+{
+    count_allocation();
+    return __libc_calloc(num, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    count_allocation();
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+// Capture of `num_packets` device packets, every channel gets a ramp.
+static void write_capture(std::string const &path, size_t num_packets)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::vector<short> packet(512);
+    short value = 0;
+    for (size_t idx = 0; idx < num_packets; idx++)
+    {
+        for (short &v : packet)
+        {
+            v = value++;
+        }
+        out.write(reinterpret_cast<const char *>(packet.data()), packet.size() * sizeof(short));
+    }
+}
+
+// Read `num_reads` times after warm-up, counting allocations of all threads meanwhile. Returns number of allocations.
+static size_t run_case(AfedriDevice &device, const char *name, std::string const &format, std::vector<size_t> const &channels,
+                       SoapySDR::Kwargs const &args, size_t num_elems, int num_reads)
+{
+    SoapySDR::Stream *stream = device.setupStream(SOAPY_SDR_RX, format, channels, args);
+    device.activateStream(stream);
+
+    std::vector<std::vector<float>> storage(channels.size(), std::vector<float>(num_elems * 2)); // big enough for any format
+    std::vector<void *> buffs;
+    for (auto &buf : storage)
+    {
+        buffs.push_back(buf.data());
+    }
+
+    int samples = 0;
+    int errors = 0;
+    for (int phase = 0; phase < 2; phase++)
+    {
+        counting.store(phase == 1);
+        for (int idx = 0; idx < ((phase == 0) ? num_reads / 4 : num_reads); idx++)
+        {
+            int flags = 0;
+            long long time_ns = 0;
+            const int ret = device.readStream(stream, buffs.data(), num_elems, flags, time_ns, 1000000);
+            if (ret > 0)
+            {
+                samples += (phase == 1) ? ret : 0;
+            }
+            else if (ret != SOAPY_SDR_OVERFLOW)
+            {
+                errors++;
+            }
+        }
+    }
+    counting.store(false);
+    const size_t res = allocations.exchange(0);
+
+    device.deactivateStream(stream);
+    device.closeStream(stream);
+
+    std::printf("%s: %d samples read, %d errors, %d allocations\n", name, samples, errors, (int)res);
+    return (samples == 0 || errors != 0) ? res + 1 : res;
+}
+
+int main(int argc, char **argv)
+{
+    const std::string path = (argc > 1) ? argv[1] : "test_no_alloc.sigmf-data";
+    write_capture(path, 4096);
+
+    int failures = 0;
+    for (int num_channels : {1, 2})
+    {
+        ReplayOptions replay;
+        replay.file = path;
+        replay.sample_rate = 2e6;
+        AfedriDevice device(replay, RecordMeta(), num_channels, UdpRxOptions());
+
+        std::vector<size_t> channels;
+        for (int ch = 0; ch < num_channels; ch++)
+        {
+            channels.push_back(ch);
+        }
+        const std::string suffix = " x" + std::to_string(num_channels);
+
+        SoapySDR::Kwargs ddc;
+        ddc["ddc_offset"] = "100000";
+        ddc["ddc_decim"] = "8";
+        SoapySDR::Kwargs spectrum;
+        spectrum["fft_size"] = "256";
+        spectrum["fft_avg"] = "4";
+
+        failures += run_case(device, ("CS16" + suffix).c_str(), SOAPY_SDR_CS16, channels, {}, 4096, 400) != 0;
+        failures += run_case(device, ("CF32" + suffix).c_str(), SOAPY_SDR_CF32, channels, {}, 4096, 400) != 0;
+        failures += run_case(device, ("CF32 DDC" + suffix).c_str(), SOAPY_SDR_CF32, channels, ddc, 512, 400) != 0;
+        failures += run_case(device, ("F32 spectrum" + suffix).c_str(), SOAPY_SDR_F32, channels, spectrum, 256, 100) != 0;
+    }
+
+    std::remove(path.c_str());
+    return failures == 0 ? 0 : 1;
+}
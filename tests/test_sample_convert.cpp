@@ -0,0 +1,78 @@
+//  SPDX-FileCopyrightText: 2023 Alexander Sholokhov <ra9yer@yahoo.com>
+//  SPDX-License-Identifier: GPL-3.0-or-later
+
+// Every CS16 -> CF32 kernel compiled in and supported by this CPU must give exactly src / 32768.0f:
+// odd lengths (vector loop and scalar tail), unaligned buffers, full int16 range including -32768 and 32767.
+
+#include "sample_convert.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static bool check(ConvertS16ToF32Impl const &impl, std::vector<short> const &input, size_t offset, size_t len)
+{
+    const float guard = 12345.0f;
+    std::vector<float> expected(len);
+    for (size_t j = 0; j < len; j++)
+    {
+        expected[j] = (float)input[offset + j] / 32768.0f;
+    }
+
+    std::vector<float> out(len + offset + 1, guard); // dst is misaligned the same way as src
+    impl.func(input.data() + offset, out.data() + offset, len);
+
+    const bool ok = std::memcmp(out.data() + offset, expected.data(), len * sizeof(float)) == 0 && out[offset + len] == guard &&
+                    (offset == 0 || out[offset - 1] == guard);
+    if (!ok)
+    {
+        std::printf("FAIL %s: offset=%zu len=%zu\n", impl.name, offset, len);
+    }
+    return ok;
+}
+
+int main()
+{
+    // the whole int16 range, extremes at both ends and in the middle of vectors
+    std::vector<short> input;
+    for (int v = -32768; v <= 32767; v++)
+    {
+        input.push_back((short)v);
+    }
+    std::mt19937 rng(1);
+    for (int idx = 0; idx < 4096; idx++)
+    {
+        const int v = (idx % 7 == 0) ? ((idx % 2) ? 32767 : -32768) : (int)(rng() % 65536) - 32768;
+        input.push_back((short)v);
+    }
+
+    const auto impls = convert_s16_to_f32_impls();
+    const ConvertS16ToF32Impl dispatched{convert_s16_to_f32, convert_s16_to_f32_impl_name()};
+
+    int failures = 0;
+    for (ConvertS16ToF32Impl const &impl : impls)
+    {
+        int impl_failures = 0;
+        for (size_t len = 0; len <= 130; len++)
+        {
+            for (size_t offset : {0, 1, 3})
+            {
+                impl_failures += check(impl, input, offset, len) ? 0 : 1;
+                impl_failures += check(impl, input, input.size() - len - offset, len) ? 0 : 1; // ends with random extremes
+            }
+        }
+        for (size_t len : {1023, 4097, 65535})
+        {
+            impl_failures += check(impl, input, 1, len) ? 0 : 1;
+        }
+        impl_failures += check(impl, input, 0, input.size()) ? 0 : 1;
+
+        std::printf("%s: %s\n", impl.name, impl_failures == 0 ? "ok" : "FAILED");
+        failures += impl_failures;
+    }
+    failures += check(dispatched, input, 0, input.size()) ? 0 : 1;
+    std::printf("selected %s, %d kernel(s) checked\n", dispatched.name, (int)impls.size());
+
+    return failures == 0 ? 0 : 1;
+}